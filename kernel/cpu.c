@@ -0,0 +1,69 @@
+#include "kernel.h"
+#include "cpu.h"
+#include "smp.h"
+
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    asm volatile("cpuid"
+                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                 : "a"(leaf), "c"(0));
+}
+
+bool cpu_has_feature_edx(uint32_t mask)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (edx & mask) == mask;
+}
+
+bool cpu_has_feature_ecx(uint32_t mask)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (ecx & mask) == mask;
+}
+
+uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)) : "memory");
+}
+
+uint32_t irq_save(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    kernel_lock();
+    return flags;
+}
+
+void irq_restore(uint32_t flags)
+{
+    kernel_unlock();
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+uint32_t local_irq_save(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void local_irq_restore(uint32_t flags)
+{
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
@@ -0,0 +1,38 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CPUID leaf 1, EDX
+#define CPUID_EDX_PSE (1u << 3)
+#define CPUID_EDX_MSR (1u << 5)
+#define CPUID_EDX_APIC (1u << 9)
+#define CPUID_EDX_MTRR (1u << 12)
+#define CPUID_EDX_PGE (1u << 13)
+#define CPUID_EDX_PAT (1u << 16)
+
+// EFLAGS
+#define EFLAGS_IF (1u << 9)
+
+// CPUID leaf 1, ECX
+#define CPUID_ECX_MONITOR (1u << 3)
+
+void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx);
+bool cpu_has_feature_edx(uint32_t mask);
+bool cpu_has_feature_ecx(uint32_t mask);
+uint64_t rdtsc(void);
+uint64_t rdmsr(uint32_t msr);
+void wrmsr(uint32_t msr, uint64_t value);
+
+// Disable interrupts and take the kernel lock, returning the previous
+// EFLAGS for irq_restore. Sections nest; the lock is released, and
+// interrupts return to their state in flags, when the outermost one ends.
+uint32_t irq_save(void);
+void irq_restore(uint32_t flags);
+
+// Disable interrupts on this CPU only, without the kernel lock
+uint32_t local_irq_save(void);
+void local_irq_restore(uint32_t flags);
+
+#endif
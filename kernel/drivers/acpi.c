@@ -0,0 +1,132 @@
+#include "drivers.h"
+#include "../memory/memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+
+// Just enough ACPI to find static tables: locate the RSDP in the BIOS areas
+// of low memory, then walk the RSDT (or the XSDT, for tables below 4 GiB).
+// Tables in low memory are read through the identity map; ones above it,
+// usually at the top of RAM, are mapped into the MMIO window.
+
+#define ACPI_EBDA_POINTER 0x40E
+#define ACPI_BIOS_START 0xE0000
+#define ACPI_BIOS_END 0x100000
+#define ACPI_MAPPINGS 16
+
+static acpi_rsdp_t* rsdp = NULL;
+static bool rsdp_searched = false;
+
+static bool acpi_checksum(const void* data, uint32_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+// The RSDP sits on a 16-byte boundary
+static acpi_rsdp_t* acpi_scan(uint32_t start, uint32_t end)
+{
+    for (uint32_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += 16) {
+        acpi_rsdp_t* candidate = (acpi_rsdp_t*)addr;
+        if (strncmp(candidate->signature, "RSD PTR ", 8) == 0 && acpi_checksum(candidate, 20)) {
+            return candidate;
+        }
+    }
+    return NULL;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp(void)
+{
+    if (rsdp_searched) return rsdp;
+    rsdp_searched = true;
+    
+    // First KiB of the EBDA, then the BIOS ROM area
+    uint32_t ebda = (uint32_t)(*(volatile uint16_t*)ACPI_EBDA_POINTER) << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000) {
+        rsdp = acpi_scan(ebda, ebda + 1024);
+    }
+    if (!rsdp) {
+        rsdp = acpi_scan(ACPI_BIOS_START, ACPI_BIOS_END);
+    }
+    return rsdp;
+}
+
+// Mappings already made, so repeated lookups do not use up the MMIO window
+typedef struct {
+    uint32_t phys;
+    uint32_t length;
+    uint8_t* virt;
+} acpi_mapping_t;
+
+static acpi_mapping_t acpi_mappings[ACPI_MAPPINGS];
+static uint32_t acpi_mapping_count = 0;
+
+static void* acpi_map(uint32_t phys, uint32_t length)
+{
+    paging_info_t info;
+    paging_get_info(&info);
+    if (phys + length <= info.identity_bytes) return (void*)phys;
+    
+    for (uint32_t i = 0; i < acpi_mapping_count; i++) {
+        acpi_mapping_t* map = &acpi_mappings[i];
+        if (phys >= map->phys && phys + length <= map->phys + map->length) {
+            return map->virt + (phys - map->phys);
+        }
+    }
+    
+    // Map whole pages around the table; neighbours often share them
+    uint32_t start = phys & PAGE_FRAME_MASK;
+    uint32_t end = (phys + length + PAGE_SIZE - 1) & PAGE_FRAME_MASK;
+    uint8_t* virt = (uint8_t*)paging_map_mmio(start, end - start, PAGE_CACHE_WB);
+    if (!virt) return NULL;
+    
+    if (acpi_mapping_count < ACPI_MAPPINGS) {
+        acpi_mappings[acpi_mapping_count].phys = start;
+        acpi_mappings[acpi_mapping_count].length = end - start;
+        acpi_mappings[acpi_mapping_count].virt = virt;
+        acpi_mapping_count++;
+    }
+    return virt + (phys - start);
+}
+
+// Map a whole table once its header says how long it is
+static acpi_header_t* acpi_map_table(uint32_t phys)
+{
+    acpi_header_t* header = (acpi_header_t*)acpi_map(phys, sizeof(acpi_header_t));
+    if (!header || header->length < sizeof(acpi_header_t)) return NULL;
+    
+    uint32_t length = header->length;
+    header = (acpi_header_t*)acpi_map(phys, length);
+    if (!header || !acpi_checksum(header, length)) return NULL;
+    return header;
+}
+
+// First table with the given 4-character signature, or NULL
+acpi_header_t* acpi_find_table(const char* signature)
+{
+    acpi_rsdp_t* root = acpi_find_rsdp();
+    if (!root) return NULL;
+    
+    // ACPI 2.0 prefers the XSDT; its 64-bit entries are usable below 4 GiB
+    bool xsdt = root->revision >= 2 && root->xsdt_address && !(root->xsdt_address >> 32);
+    acpi_header_t* sdt = acpi_map_table(xsdt ? (uint32_t)root->xsdt_address : root->rsdt_address);
+    if (!sdt) return NULL;
+    
+    uint32_t entry_size = xsdt ? 8 : 4;
+    uint32_t count = (sdt->length - sizeof(acpi_header_t)) / entry_size;
+    uint8_t* entries = (uint8_t*)sdt + sizeof(acpi_header_t);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = 0;
+        memcpy(&phys, entries + i * entry_size, entry_size);
+        if (phys == 0 || (phys >> 32)) continue;
+        
+        acpi_header_t* header = (acpi_header_t*)acpi_map((uint32_t)phys, sizeof(acpi_header_t));
+        if (!header || strncmp(header->signature, signature, 4) != 0) continue;
+        return acpi_map_table((uint32_t)phys);
+    }
+    return NULL;
+}
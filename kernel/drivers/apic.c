@@ -0,0 +1,424 @@
+#include "drivers.h"
+#include "../interrupts.h"
+#include "../memory/memory.h"
+#include "../time/time.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Local APIC and I/O APIC, found through the ACPI "APIC" table (MADT).
+// When both are there the 8259 PICs are masked and the ISA IRQs are routed
+// through the I/O APIC to the vectors the PICs used, 32-47, so handlers do
+// not change; an EOI becomes one store to the local APIC instead of port
+// writes. The local APIC's timer, calibrated against the clocksource, is
+// the best clock-event device. "apic=off" keeps the PICs.
+//
+// Every CPU has its own local APIC at the same address; the registers seen
+// are always those of the CPU doing the access. That makes the timer a
+// per-CPU device, and it is how one CPU sends another an interprocessor
+// interrupt, by writing the target and vector to its interrupt command
+// register.
+
+#define MSR_APIC_BASE       0x1B
+#define APIC_BASE_X2APIC    (1u << 10)
+#define APIC_BASE_ENABLE    (1u << 11)
+#define APIC_BASE_MASK      0xFFFFF000u
+
+// Local APIC registers
+#define LAPIC_ID            0x020
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ESR           0x280
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_LVT_ERROR     0x370
+#define LAPIC_TIMER_INIT    0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    (1u << 8)
+#define LAPIC_DELIVERY_NMI  (4u << 8)
+#define LAPIC_ACTIVE_LOW    (1u << 13)
+#define LAPIC_LEVEL         (1u << 15)
+#define LAPIC_MASKED        (1u << 16)
+#define LAPIC_TIMER_PERIODIC (1u << 17)
+#define LAPIC_DELIVERY_INIT (5u << 8)
+#define LAPIC_DELIVERY_STARTUP (6u << 8)
+#define LAPIC_ICR_PENDING   (1u << 12)
+#define LAPIC_ICR_ASSERT    (1u << 14)
+#define LAPIC_DIVIDE_16     0x3
+
+// I/O APIC registers, reached through an index and a data window
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_VERSION      0x01
+#define IOAPIC_REDIRECT(n)  (0x10 + 2 * (n))
+#define IOAPIC_ACTIVE_LOW   (1u << 13)
+#define IOAPIC_LEVEL        (1u << 15)
+#define IOAPIC_MASKED       (1u << 16)
+
+// MADT entry types and flags
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_NMI      4
+#define MADT_LAPIC_ADDRESS  5
+#define MADT_CPU_ENABLED    1
+#define MADT_POLARITY_MASK  0x3     // MPS INTI flags: 0 means the bus default
+#define MADT_POLARITY_LOW   0x3
+#define MADT_TRIGGER_MASK   0xC
+#define MADT_TRIGGER_LEVEL  0xC
+
+#define PIC1_DATA           0x21
+#define PIC2_DATA           0xA1
+#define ISA_IRQS            16
+#define ISA_CASCADE_IRQ     2
+#define IRQ_VECTOR_BASE     32
+
+#define APIC_CALIBRATE_NS   (10 * NSEC_PER_MSEC)
+#define APIC_TIMER_MIN_NS   1000
+
+typedef struct {
+    volatile uint8_t* regs;
+    uint32_t gsi_base;
+    uint32_t pins;
+    uint8_t id;
+} ioapic_t;
+
+static volatile uint8_t* lapic_regs = NULL;
+static uint32_t lapic_phys = 0;
+static ioapic_t ioapics[APIC_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+static uint8_t cpu_apic_ids[APIC_MAX_CPUS];
+static uint32_t cpu_count = 0;
+static uint32_t isa_gsi[ISA_IRQS];          // ISA IRQ to global system interrupt
+static uint16_t isa_flags[ISA_IRQS];
+static uint8_t nmi_lint = 1;                // LINT1 is wired to NMI unless told otherwise
+static uint16_t nmi_flags = 0;
+static uint32_t lapic_timer_hz = 0;
+static uint8_t bsp_apic_id = 0;
+static bool apic_enabled = false;
+
+static uint32_t lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(lapic_regs + reg);
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(lapic_regs + reg) = value;
+}
+
+static uint32_t ioapic_read(ioapic_t* io, uint32_t reg)
+{
+    *(volatile uint32_t*)(io->regs + IOAPIC_REGSEL) = reg;
+    return *(volatile uint32_t*)(io->regs + IOAPIC_WINDOW);
+}
+
+static void ioapic_write(ioapic_t* io, uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(io->regs + IOAPIC_REGSEL) = reg;
+    *(volatile uint32_t*)(io->regs + IOAPIC_WINDOW) = value;
+}
+
+static ioapic_t* ioapic_for_gsi(uint32_t gsi)
+{
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi < ioapics[i].gsi_base + ioapics[i].pins) {
+            return &ioapics[i];
+        }
+    }
+    return NULL;
+}
+
+static void madt_add_ioapic(acpi_madt_ioapic_t* entry)
+{
+    if (ioapic_count >= APIC_MAX_IOAPICS) return;
+    
+    ioapic_t* io = &ioapics[ioapic_count];
+    io->regs = (volatile uint8_t*)paging_map_mmio(entry->address, PAGE_SIZE, PAGE_CACHE_UC);
+    if (!io->regs) return;
+    io->gsi_base = entry->gsi_base;
+    io->id = entry->id;
+    io->pins = ((ioapic_read(io, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    ioapic_count++;
+}
+
+// Collect CPUs, I/O APICs and ISA overrides; false if there is nothing to use
+static bool madt_parse(void)
+{
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    if (!madt) return false;
+    
+    for (uint32_t irq = 0; irq < ISA_IRQS; irq++) {
+        isa_gsi[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+    lapic_phys = madt->lapic_address;
+    
+    uint8_t* entry = (uint8_t*)(madt + 1);
+    uint8_t* end = (uint8_t*)madt + madt->header.length;
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+            case MADT_LAPIC: {
+                acpi_madt_lapic_t* cpu = (acpi_madt_lapic_t*)entry;
+                if ((cpu->flags & MADT_CPU_ENABLED) && cpu_count < APIC_MAX_CPUS) {
+                    cpu_apic_ids[cpu_count++] = cpu->apic_id;
+                }
+                break;
+            }
+            case MADT_IOAPIC:
+                madt_add_ioapic((acpi_madt_ioapic_t*)entry);
+                break;
+            case MADT_OVERRIDE: {
+                acpi_madt_override_t* override = (acpi_madt_override_t*)entry;
+                if (override->bus == 0 && override->source < ISA_IRQS) {
+                    isa_gsi[override->source] = override->gsi;
+                    isa_flags[override->source] = override->flags;
+                }
+                break;
+            }
+            case MADT_LAPIC_NMI: {
+                acpi_madt_nmi_t* nmi = (acpi_madt_nmi_t*)entry;
+                nmi_lint = nmi->lint;
+                nmi_flags = nmi->flags;
+                break;
+            }
+            case MADT_LAPIC_ADDRESS: {
+                acpi_madt_lapic_address_t* override = (acpi_madt_lapic_address_t*)entry;
+                if (!(override->address >> 32)) lapic_phys = (uint32_t)override->address;
+                break;
+            }
+        }
+        entry += entry[1];
+    }
+    return lapic_phys != 0 && ioapic_count > 0;
+}
+
+// Send a global system interrupt to a vector on the given CPU; flags are
+// MPS INTI flags, zero for an edge-triggered, active-high ISA line
+static bool ioapic_route(uint32_t gsi, uint8_t vector, uint16_t flags, uint8_t dest)
+{
+    ioapic_t* io = ioapic_for_gsi(gsi);
+    if (!io) return false;
+    
+    uint32_t pin = gsi - io->gsi_base;
+    uint32_t low = vector;
+    if ((flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) low |= IOAPIC_ACTIVE_LOW;
+    if ((flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) low |= IOAPIC_LEVEL;
+    
+    // High half first, so the entry is never live with a stale destination
+    ioapic_write(io, IOAPIC_REDIRECT(pin) + 1, (uint32_t)dest << 24);
+    ioapic_write(io, IOAPIC_REDIRECT(pin), low);
+    return true;
+}
+
+// Route an ISA IRQ, through any override, to a vector on this CPU
+bool apic_route_irq(uint8_t irq, uint8_t vector)
+{
+    if (!apic_enabled || irq >= ISA_IRQS) return false;
+    return ioapic_route(isa_gsi[irq], vector, isa_flags[irq], apic_id());
+}
+
+static void lapic_enable(void)
+{
+    wrmsr(MSR_APIC_BASE, (rdmsr(MSR_APIC_BASE) & ~(uint64_t)APIC_BASE_MASK) | lapic_phys | APIC_BASE_ENABLE);
+    
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    
+    // External interrupts now come through the I/O APIC, not LINT0
+    uint32_t nmi = LAPIC_DELIVERY_NMI;
+    if ((nmi_flags & MADT_POLARITY_MASK) == MADT_POLARITY_LOW) nmi |= LAPIC_ACTIVE_LOW;
+    if ((nmi_flags & MADT_TRIGGER_MASK) == MADT_TRIGGER_LEVEL) nmi |= LAPIC_LEVEL;
+    lapic_write(nmi_lint ? LAPIC_LVT_LINT0 : LAPIC_LVT_LINT1, LAPIC_MASKED);
+    lapic_write(nmi_lint ? LAPIC_LVT_LINT1 : LAPIC_LVT_LINT0, nmi);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_MASKED);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED);
+    
+    // The error status register is cleared by back-to-back writes
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_timer_set_periodic(void)
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_hz / 1000);
+}
+
+static void lapic_timer_set_oneshot(uint64_t delta_ns)
+{
+    // Round up: the interrupt must not come before the deadline
+    uint64_t count = div_u64(delta_ns * lapic_timer_hz + NSEC_PER_SEC - 1, NSEC_PER_SEC);
+    if (count == 0) count = 1;
+    if (count > 0xFFFFFFFFull) count = 0xFFFFFFFFull;
+    
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)count);
+}
+
+static void lapic_timer_shutdown(void)
+{
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+// Idle only uses C1 (HLT, or MWAIT with hint 0), where the timer keeps
+// counting, so it can outrank the HPET without the ARAT feature
+static clockevent_t lapic_event = {
+    .name = "lapic",
+    .rating = 300,
+    .min_delta_ns = APIC_TIMER_MIN_NS,
+    .set_periodic = lapic_timer_set_periodic,
+    .set_oneshot = lapic_timer_set_oneshot,
+    .shutdown = lapic_timer_shutdown,
+    .per_cpu = true,
+};
+
+// Count timer ticks, after the divider, over a stretch of the clocksource
+static uint32_t lapic_timer_calibrate(void)
+{
+    uint32_t irq = irq_save();
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_MASKED | APIC_TIMER_VECTOR);
+    
+    uint64_t start = ktime_get_ns();
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t now;
+    do {
+        now = ktime_get_ns();
+    } while (now - start < APIC_CALIBRATE_NS);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    irq_restore(irq);
+    
+    return (uint32_t)div_u64((uint64_t)elapsed * NSEC_PER_SEC, (uint32_t)(now - start));
+}
+
+// After clocksource_init, before hpet_init: with the local APIC timer
+// driving the tick, the HPET is never put into legacy replacement mode and
+// IRQ8 stays with the RTC
+bool apic_init(void)
+{
+    if (kernel_boot_option("apic=off")) return false;
+    if (!cpu_has_feature_edx(CPUID_EDX_APIC) || !cpu_has_feature_edx(CPUID_EDX_MSR)) return false;
+    if (rdmsr(MSR_APIC_BASE) & APIC_BASE_X2APIC) return false;
+    if (!madt_parse()) return false;
+    
+    lapic_regs = (volatile uint8_t*)paging_map_mmio(lapic_phys, PAGE_SIZE, PAGE_CACHE_UC);
+    if (!lapic_regs) return false;
+    
+    uint32_t irq = irq_save();
+    
+    // Mask every 8259 line; from here on interrupts arrive through the APICs
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+    lapic_enable();
+    apic_enabled = true;
+    bsp_apic_id = apic_id();
+    
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        for (uint32_t pin = 0; pin < ioapics[i].pins; pin++) {
+            ioapic_write(&ioapics[i], IOAPIC_REDIRECT(pin), IOAPIC_MASKED);
+        }
+    }
+    for (uint8_t isa_irq = 0; isa_irq < ISA_IRQS; isa_irq++) {
+        if (isa_irq == ISA_CASCADE_IRQ) continue;
+        apic_route_irq(isa_irq, IRQ_VECTOR_BASE + isa_irq);
+    }
+    irq_restore(irq);
+    
+    lapic_timer_hz = lapic_timer_calibrate();
+    if (lapic_timer_hz >= 1000) {
+        lapic_event.max_delta_ns = div_u64(0xFFFFFFFFull * NSEC_PER_SEC, lapic_timer_hz);
+        if (lapic_event.max_delta_ns > NSEC_PER_SEC) lapic_event.max_delta_ns = NSEC_PER_SEC;
+        clockevent_register(&lapic_event);
+    }
+    return true;
+}
+
+bool apic_is_enabled(void)
+{
+    return apic_enabled;
+}
+
+void apic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+uint8_t apic_id(void)
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+// An application processor enables its own local APIC; it shares the
+// boot CPU's timer calibration
+void apic_init_ap(void)
+{
+    uint32_t irq = irq_save();
+    lapic_enable();
+    irq_restore(irq);
+}
+
+// Write the interrupt command register and wait until the local APIC has
+// sent the message
+static void lapic_send_icr(uint8_t dest, uint32_t command)
+{
+    uint32_t irq = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)dest << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        asm volatile("pause");
+    }
+    irq_restore(irq);
+}
+
+void apic_send_ipi(uint8_t dest, uint8_t vector)
+{
+    if (!apic_enabled) return;
+    lapic_send_icr(dest, vector);
+}
+
+// Reset a CPU into its wait-for-STARTUP state
+void apic_send_init(uint8_t dest)
+{
+    lapic_send_icr(dest, LAPIC_DELIVERY_INIT | LAPIC_ICR_ASSERT);
+}
+
+// Start a waiting CPU in real mode at page, i.e. address page << 12
+void apic_send_startup(uint8_t dest, uint8_t page)
+{
+    lapic_send_icr(dest, LAPIC_DELIVERY_STARTUP | page);
+}
+
+// Local APIC timer interrupt
+void apic_timer_handler(void)
+{
+    tick_handle();
+}
+
+void apic_get_info(apic_info_t* info)
+{
+    memset(info, 0, sizeof(*info));
+    info->enabled = apic_enabled;
+    if (!apic_enabled) return;
+    
+    info->lapic_address = lapic_phys;
+    info->bsp_id = bsp_apic_id;
+    info->timer_hz = lapic_timer_hz;
+    info->cpu_count = cpu_count;
+    memcpy(info->cpu_apic_ids, cpu_apic_ids, cpu_count);
+    info->ioapic_count = ioapic_count;
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        info->ioapic_pins += ioapics[i].pins;
+    }
+}
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "../multiboot.h"
 
 // VESA Framebuffer
 typedef struct {
@@ -15,7 +16,14 @@ typedef struct {
     bool initialized;
 } vesa_info_t;
 
-bool vesa_init(void);
+typedef struct {
+    uint32_t bytes;             // Framebuffer size written per clear
+    uint32_t uc_cycles;         // TSC cycles per vesa_clear, uncached mapping
+    uint32_t wc_cycles;         // TSC cycles per vesa_clear, write-combining mapping
+} vesa_bench_t;
+
+bool vesa_init(multiboot_info_t* mbi);
+bool vesa_benchmark(vesa_bench_t* result);
 void vesa_set_pixel(uint32_t x, uint32_t y, uint32_t color);
 void vesa_fill_rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color);
 void vesa_draw_char(uint32_t x, uint32_t y, char c, uint32_t fg, uint32_t bg);
@@ -44,6 +52,7 @@ typedef struct {
 void keyboard_init(void);
 void keyboard_handler(uint8_t scancode);
 char keyboard_get_char(void);
+char keyboard_wait_char(void);
 bool keyboard_is_key_pressed(void);
 keyboard_state_t* keyboard_get_state(void);
 
@@ -58,8 +67,16 @@ typedef struct {
     bool initialized;
 } rtc_time_t;
 
+typedef struct {
+    uint32_t irq_syncs;         // Set on the update-ended interrupt, to the edge of a second
+    uint32_t polled_syncs;      // IRQ8 unavailable: compared with a read of the RTC
+    int32_t last_offset_us;     // Wall clock correction at the last sync
+} rtc_stats_t;
+
 void rtc_init(void);
+void rtc_handler(void);
 void rtc_get_time(rtc_time_t* time);
+void rtc_get_stats(rtc_stats_t* stats);
 uint16_t rtc_get_full_year(void);
 uint8_t rtc_get_month(void);
 uint8_t rtc_get_day(void);
@@ -67,7 +84,133 @@ uint8_t rtc_get_hour(void);
 uint8_t rtc_get_minute(void);
 uint8_t rtc_get_second(void);
 
+// ACPI tables
+#define ACPI_SPACE_MEMORY 0
+
+typedef struct {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;            // ACPI 2.0 and later from here on
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct {
+    acpi_header_t header;
+    uint32_t event_timer_block_id;
+    uint8_t address_space;      // Generic address structure of the registers
+    uint8_t register_bit_width;
+    uint8_t register_bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+    uint8_t hpet_number;
+    uint16_t minimum_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+// Multiple APIC Description Table, signature "APIC"
+typedef struct {
+    acpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_lapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed)) acpi_madt_ioapic_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t bus;
+    uint8_t source;             // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) acpi_madt_override_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint8_t processor_id;
+    uint16_t flags;
+    uint8_t lint;
+} __attribute__((packed)) acpi_madt_nmi_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed)) acpi_madt_lapic_address_t;
+
+acpi_header_t* acpi_find_table(const char* signature);
+
+// APIC (local and I/O APIC interrupt controllers)
+#define APIC_MAX_CPUS 16
+#define APIC_MAX_IOAPICS 4
+#define APIC_TIMER_VECTOR 48
+#define APIC_RESCHEDULE_VECTOR 49
+#define APIC_TLB_VECTOR 50
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+typedef struct {
+    bool enabled;
+    uint32_t lapic_address;
+    uint8_t bsp_id;
+    uint32_t timer_hz;          // Local APIC timer, after its divider
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[APIC_MAX_CPUS];
+    uint32_t ioapic_count;
+    uint32_t ioapic_pins;
+} apic_info_t;
+
+bool apic_init(void);
+bool apic_is_enabled(void);
+bool apic_route_irq(uint8_t irq, uint8_t vector);
+void apic_eoi(void);
+uint8_t apic_id(void);
+void apic_timer_handler(void);
+void apic_init_ap(void);
+void apic_send_ipi(uint8_t dest, uint8_t vector);
+void apic_send_init(uint8_t dest);
+void apic_send_startup(uint8_t dest, uint8_t page);
+void apic_get_info(apic_info_t* info);
+
+// HPET (High Precision Event Timer)
+bool hpet_init(void);
+
 // PIT (Programmable Interval Timer)
+#define PIT_FREQUENCY 1193182   // Input clock, Hz
+
 void pit_init(void);
 void pit_handler(void);
 uint32_t pit_get_ticks(void);
@@ -75,6 +218,7 @@ uint32_t pit_get_milliseconds(void);
 uint32_t pit_get_seconds(void);
 void pit_delay_ms(uint32_t milliseconds);
 bool pit_is_initialized(void);
+uint64_t pit_read_cycles(void);
 
 #endif
 
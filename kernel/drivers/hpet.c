@@ -0,0 +1,169 @@
+#include "drivers.h"
+#include "../memory/memory.h"
+#include "../time/time.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// High Precision Event Timer, found through the ACPI "HPET" table. Its main
+// counter is a clocksource; timer 0 is a one-shot clock-event device. With
+// only the 8259 PIC, timer 0 can reach the CPU solely through the legacy
+// replacement route, which takes over IRQ0 from the PIT (and IRQ8 from the
+// RTC). "hpet=off" on the command line leaves the HPET alone.
+
+#define HPET_GCAP_ID        0x000
+#define HPET_GCAP_PERIOD    0x004   // Upper half: counter period in femtoseconds
+#define HPET_GEN_CONF       0x010
+#define HPET_MAIN_COUNTER   0x0F0
+#define HPET_TIMER_CONF(n)  (0x100 + 0x20 * (n))
+#define HPET_TIMER_CMP(n)   (0x108 + 0x20 * (n))
+
+#define HPET_CAP_COUNT_64   (1u << 13)
+#define HPET_CAP_LEGACY     (1u << 15)
+#define HPET_CONF_ENABLE    (1u << 0)
+#define HPET_CONF_LEGACY    (1u << 1)
+#define HPET_TN_INT_ENABLE  (1u << 2)
+#define HPET_TN_PERIODIC    (1u << 3)
+#define HPET_TN_SIZE_64     (1u << 5)
+#define HPET_TN_32BIT       (1u << 8)
+
+#define HPET_MAX_PERIOD_FS  100000000u  // The spec caps the period at 100 ns
+#define HPET_MIN_DELTA_NS   10000
+
+static volatile uint8_t* hpet_regs = NULL;
+static bool hpet_counter_64 = false;
+static bool hpet_timer_64 = false;
+static bool hpet_legacy = false;
+static volatile uint64_t hpet_clock = 0; // A 32-bit main counter, extended; last value read
+
+static uint32_t hpet_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(hpet_regs + reg);
+}
+
+static void hpet_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(hpet_regs + reg) = value;
+}
+
+// Store value at word if it still holds expected; returns what it held
+static inline uint64_t cmpxchg64(volatile uint64_t* word, uint64_t expected, uint64_t value)
+{
+    asm volatile("lock cmpxchg8b %1"
+                 : "+A"(expected), "+m"(*word)
+                 : "b"((uint32_t)value), "c"((uint32_t)(value >> 32))
+                 : "memory");
+    return expected;
+}
+
+// A 32-bit counter wraps in minutes, far more than the tick ever waits, so
+// one carry is all that can have happened since the last read. Any CPU may
+// read: the newest value wins the compare-exchange, a reader that lost
+// starts over from it.
+static uint64_t hpet_read_counter32(void)
+{
+    // Exchanging 0 for 0 is a plain atomic 64-bit read
+    uint64_t last = cmpxchg64(&hpet_clock, 0, 0);
+    while (1) {
+        uint32_t low = hpet_read(HPET_MAIN_COUNTER);
+        uint32_t high = (uint32_t)(last >> 32);
+        if (low < (uint32_t)last) high++;
+        uint64_t value = ((uint64_t)high << 32) | low;
+        
+        uint64_t seen = cmpxchg64(&hpet_clock, last, value);
+        if (seen == last) return value;
+        last = seen;
+    }
+}
+
+// Two 32-bit halves; retry if the low half carried between the reads
+static uint64_t hpet_read_counter(void)
+{
+    if (!hpet_counter_64) return hpet_read_counter32();
+    
+    uint32_t high, low;
+    do {
+        high = hpet_read(HPET_MAIN_COUNTER + 4);
+        low = hpet_read(HPET_MAIN_COUNTER);
+    } while (high != hpet_read(HPET_MAIN_COUNTER + 4));
+    return ((uint64_t)high << 32) | low;
+}
+
+static clocksource_t hpet_clocksource = {
+    .name = "hpet",
+    .read = hpet_read_counter,
+    .rating = 250,
+    .max_idle_ns = NSEC_PER_SEC,
+};
+
+static void hpet_set_oneshot(uint64_t delta_ns)
+{
+    // Route timer 0 to IRQ0 the first time it is needed
+    if (!hpet_legacy) {
+        hpet_write(HPET_GEN_CONF, hpet_read(HPET_GEN_CONF) | HPET_CONF_LEGACY);
+        uint32_t conf = hpet_read(HPET_TIMER_CONF(0));
+        conf &= ~HPET_TN_PERIODIC;
+        conf |= HPET_TN_INT_ENABLE;
+        if (!hpet_timer_64) conf |= HPET_TN_32BIT;
+        hpet_write(HPET_TIMER_CONF(0), conf);
+        hpet_legacy = true;
+    }
+    
+    uint64_t cycles = div_u64(delta_ns * hpet_clocksource.hz + NSEC_PER_SEC - 1, NSEC_PER_SEC);
+    if (cycles == 0) cycles = 1;
+    
+    // The comparator only fires on a match, so a deadline the counter has
+    // already passed would never fire: check, and push it out if so
+    while (1) {
+        uint64_t target = hpet_read_counter() + cycles;
+        hpet_write(HPET_TIMER_CMP(0), (uint32_t)target);
+        if (hpet_timer_64) hpet_write(HPET_TIMER_CMP(0) + 4, (uint32_t)(target >> 32));
+        if ((int32_t)((uint32_t)target - hpet_read(HPET_MAIN_COUNTER)) > 0) break;
+        cycles *= 2;
+    }
+}
+
+static void hpet_shutdown(void)
+{
+    hpet_write(HPET_TIMER_CONF(0), hpet_read(HPET_TIMER_CONF(0)) & ~HPET_TN_INT_ENABLE);
+}
+
+static clockevent_t hpet_event = {
+    .name = "hpet",
+    .rating = 200,
+    .min_delta_ns = HPET_MIN_DELTA_NS,
+    .max_delta_ns = NSEC_PER_SEC,
+    .set_oneshot = hpet_set_oneshot,
+    .shutdown = hpet_shutdown,
+};
+
+// After clocksource_init and pit_init, so both can give way to the HPET
+bool hpet_init(void)
+{
+    if (kernel_boot_option("hpet=off")) return false;
+    
+    acpi_hpet_t* table = (acpi_hpet_t*)acpi_find_table("HPET");
+    if (!table || table->address_space != ACPI_SPACE_MEMORY) return false;
+    if (table->address == 0 || (table->address >> 32)) return false;
+    
+    hpet_regs = (volatile uint8_t*)paging_map_mmio((uint32_t)table->address, 1024, PAGE_CACHE_UC);
+    if (!hpet_regs) return false;
+    
+    uint32_t caps = hpet_read(HPET_GCAP_ID);
+    uint32_t period = hpet_read(HPET_GCAP_PERIOD);
+    if (period == 0 || period > HPET_MAX_PERIOD_FS) return false;
+    hpet_counter_64 = (caps & HPET_CAP_COUNT_64) != 0;
+    hpet_timer_64 = (hpet_read(HPET_TIMER_CONF(0)) & HPET_TN_SIZE_64) != 0;
+    
+    // Start the main counter where it stands; timer 0 stays quiet until used
+    hpet_write(HPET_TIMER_CONF(0), hpet_read(HPET_TIMER_CONF(0)) & ~HPET_TN_INT_ENABLE);
+    hpet_write(HPET_GEN_CONF, (hpet_read(HPET_GEN_CONF) & ~HPET_CONF_LEGACY) | HPET_CONF_ENABLE);
+    hpet_clock = hpet_read(HPET_MAIN_COUNTER);
+    
+    clocksource_set_hz(&hpet_clocksource, div_u64(1000000000000000ull, period));
+    clocksource_register(&hpet_clocksource);
+    if (caps & HPET_CAP_LEGACY) {
+        clockevent_register(&hpet_event);
+    }
+    return true;
+}
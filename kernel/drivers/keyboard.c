@@ -2,11 +2,14 @@
 #include "../kernel.h"
 #include "../interrupts.h"
 #include "../lib/lib.h"
+#include "../sched/sched.h"
+#include "../cpu.h"
 
 extern unsigned char inb(unsigned short port);
 extern void outb(unsigned short port, unsigned char data);
 
 keyboard_state_t keyboard_state = {0};
+static wait_queue_t keyboard_waiters;
 
 // US QWERTY keyboard scancode to ASCII mapping (set 1)
 static const char scancode_to_ascii[128] = {
@@ -34,6 +37,7 @@ void keyboard_init(void)
     keyboard_state.alt = false;
     keyboard_state.last_char = 0;
     keyboard_state.key_pressed = false;
+    wait_queue_init(&keyboard_waiters);
     
     // Enable keyboard interrupt (IRQ1)
     outb(0x21, inb(0x21) & 0xFD);
@@ -70,6 +74,7 @@ void keyboard_handler(uint8_t scancode)
                 keyboard_state.last_char = c;
                 keyboard_state.key_pressed = true;
                 // Don't print here - let shell_process_input handle it
+                wake_up(&keyboard_waiters);
             }
         }
     }
@@ -84,6 +89,19 @@ char keyboard_get_char(void)
     return 0;
 }
 
+// Block until a key is pressed
+char keyboard_wait_char(void)
+{
+    uint32_t irq = irq_save();
+    while (!keyboard_state.key_pressed) {
+        wait_queue_sleep(&keyboard_waiters);
+    }
+    keyboard_state.key_pressed = false;
+    char c = keyboard_state.last_char;
+    irq_restore(irq);
+    return c;
+}
+
 bool keyboard_is_key_pressed(void)
 {
     return keyboard_state.key_pressed;
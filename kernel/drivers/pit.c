@@ -1,29 +1,49 @@
 #include "drivers.h"
 #include "../interrupts.h"
 #include "../lib/lib.h"
+#include "../kernel.h"
+#include "../sched/sched.h"
+#include "../time/time.h"
+#include "../cpu.h"
+#include "../smp.h"
 
 // PIT I/O ports
 #define PIT_CHANNEL0 0x40
 #define PIT_CHANNEL1 0x41
 #define PIT_CHANNEL2 0x42
 #define PIT_COMMAND  0x43
+#define PIT_PORT_B   0x61  // Bit 0 gates channel 2, bit 1 drives the speaker
 
 // PIT command byte format
 #define PIT_CHANNEL0_SEL 0x00
+#define PIT_CHANNEL2_SEL 0x80
+#define PIT_LATCH        0x00
 #define PIT_ACCESS_LOHI  0x30
+#define PIT_MODE_0       0x00  // Interrupt on terminal count (one-shot)
+#define PIT_MODE_2       0x04  // Rate generator
 #define PIT_MODE_3       0x06  // Square wave generator
 
-// PIT frequency: 1193182 Hz
-#define PIT_BASE_FREQ 1193182
+#define PIT_GATE_CH2     0x01
+#define PIT_SPEAKER      0x02
+
 #define PIT_TARGET_FREQ 1000  // 1000 Hz = 1ms per tick
 
-static volatile uint32_t pit_ticks = 0;
+// Channel 0 is a clock-event device: periodic at 1 kHz, or a one-shot of at
+// most 16 bits of input cycles. Channel 2 counts down freely as the "pit"
+// clocksource and wraps every 54.9 ms, so it must be read more often than
+// that.
+#define PIT_MAX_IDLE_NS (50 * NSEC_PER_MSEC)
+#define PIT_MIN_ONESHOT 64    // Input cycles; shorter counts may be missed
+
 static bool pit_initialized = false;
+static uint64_t clock_cycles = 0;     // PIT input cycles counted by channel 2
+static uint16_t clock_last = 0;
+static spinlock_t clock_lock;         // Latch, read and fold as one, on any CPU
 
-void pit_init(void)
+static void pit_set_periodic(void)
 {
     // Calculate divisor for ~1ms ticks (1000 Hz)
-    uint16_t divisor = PIT_BASE_FREQ / PIT_TARGET_FREQ;
+    uint16_t divisor = PIT_FREQUENCY / PIT_TARGET_FREQ;
     
     // Send command byte: channel 0, access mode lobyte/hibyte, mode 3
     outb(PIT_COMMAND, PIT_CHANNEL0_SEL | PIT_ACCESS_LOHI | PIT_MODE_3);
@@ -31,40 +51,104 @@ void pit_init(void)
     // Send divisor (low byte, then high byte)
     outb(PIT_CHANNEL0, divisor & 0xFF);
     outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+}
+
+static void pit_set_oneshot(uint64_t delta_ns)
+{
+    // Round up: the interrupt must not come before the deadline
+    uint64_t count = div_u64(delta_ns * PIT_FREQUENCY + NSEC_PER_SEC - 1, NSEC_PER_SEC);
+    if (count < PIT_MIN_ONESHOT) count = PIT_MIN_ONESHOT;
+    if (count > 0xFFFF) count = 0xFFFF;
+    
+    outb(PIT_COMMAND, PIT_CHANNEL0_SEL | PIT_ACCESS_LOHI | PIT_MODE_0);
+    outb(PIT_CHANNEL0, count & 0xFF);
+    outb(PIT_CHANNEL0, (count >> 8) & 0xFF);
+}
+
+// A mode 0 control word without a count leaves channel 0 stopped
+static void pit_shutdown(void)
+{
+    outb(PIT_COMMAND, PIT_CHANNEL0_SEL | PIT_ACCESS_LOHI | PIT_MODE_0);
+}
+
+static clockevent_t pit_event = {
+    .name = "pit",
+    .rating = 100,
+    .min_delta_ns = 60000,
+    .max_delta_ns = PIT_MAX_IDLE_NS,
+    .set_periodic = pit_set_periodic,
+    .set_oneshot = pit_set_oneshot,
+    .shutdown = pit_shutdown,
+};
+
+// Fold the cycles channel 2 counted since the last read into the clock;
+// clock_lock must be held
+static void clock_update(void)
+{
+    outb(PIT_COMMAND, PIT_CHANNEL2_SEL | PIT_LATCH);
+    uint16_t count = inb(PIT_CHANNEL2);
+    count |= (uint16_t)inb(PIT_CHANNEL2) << 8;
+    
+    // Down counter: the 16-bit difference is right across a wrap
+    clock_cycles += (uint16_t)(clock_last - count);
+    clock_last = count;
+}
+
+// Cycles since pit_init; the raw counter behind the "pit" clocksource.
+// Reading the counter takes three port accesses that another CPU must not
+// interleave with, but nothing else, so this stays off the kernel lock.
+uint64_t pit_read_cycles(void)
+{
+    uint32_t flags = local_irq_save();
+    spin_lock(&clock_lock);
+    clock_update();
+    uint64_t cycles = clock_cycles;
+    spin_unlock(&clock_lock);
+    local_irq_restore(flags);
+    return cycles;
+}
+
+void pit_init(void)
+{
+    // Channel 2 free running over the full 16 bits, speaker off
+    outb(PIT_PORT_B, (inb(PIT_PORT_B) & ~PIT_SPEAKER) | PIT_GATE_CH2);
+    outb(PIT_COMMAND, PIT_CHANNEL2_SEL | PIT_ACCESS_LOHI | PIT_MODE_2);
+    outb(PIT_CHANNEL2, 0);
+    outb(PIT_CHANNEL2, 0);
+    clock_cycles = 0;
+    clock_last = 0;
     
-    pit_ticks = 0;
+    clockevent_register(&pit_event);
     pit_initialized = true;
 }
 
+// IRQ0: channel 0, or HPET timer 0 once it replaces the PIT
 void pit_handler(void)
 {
-    pit_ticks++;
+    tick_handle();
 }
 
 uint32_t pit_get_ticks(void)
 {
-    return pit_ticks;
+    return tick_get_ms();
 }
 
 // Get milliseconds since boot
 uint32_t pit_get_milliseconds(void)
 {
-    return pit_ticks;
+    return tick_get_ms();
 }
 
 // Get seconds since boot
 uint32_t pit_get_seconds(void)
 {
-    return pit_ticks / 1000;
+    return tick_get_ms() / 1000;
 }
 
-// Simple delay function (approximate, in milliseconds)
+// Sleep for at least the given number of milliseconds; the CPU is free meanwhile
 void pit_delay_ms(uint32_t milliseconds)
 {
-    uint32_t start = pit_get_ticks();
-    while ((pit_get_ticks() - start) < milliseconds) {
-        asm volatile("pause");
-    }
+    thread_sleep_ms(milliseconds);
 }
 
 bool pit_is_initialized(void)
@@ -1,6 +1,9 @@
 #include "drivers.h"
 #include "../interrupts.h"
 #include "../lib/lib.h"
+#include "../sched/sched.h"
+#include "../time/time.h"
+#include "../cpu.h"
 
 // RTC I/O ports
 #define CMOS_ADDRESS 0x70
@@ -15,12 +18,32 @@
 #define RTC_YEAR     0x09
 #define RTC_STATUS_A 0x0A
 #define RTC_STATUS_B 0x0B
+#define RTC_STATUS_C 0x0C
 
 // RTC Status Register B flags
 #define RTC_24HOUR   0x02
 #define RTC_BINARY   0x04
+#define RTC_UIE      0x10  // Update-ended interrupt enable
 
-static rtc_time_t rtc_time = {0};
+// Status Register A and C flags
+#define RTC_UIP      0x80  // Update in progress
+#define RTC_UF       0x10  // Update ended
+
+// The CMOS clock is read once at boot; after that wall time is the
+// monotonic clock plus an offset, so asking for the date costs a few
+// divisions instead of a wait for the RTC and six port reads. The offset is
+// set exactly when the update-ended interrupt (IRQ8) says a new second has
+// begun, at boot and every RTC_RESYNC_MS to take out clocksource drift.
+// When the interrupt never comes (HPET legacy replacement takes IRQ8), the
+// resync reads the RTC instead and can only correct whole seconds.
+#define RTC_RESYNC_MS 60000
+#define RTC_DAYS_TO_EPOCH 719468    // Days from 0000-03-01 to 1970-01-01
+#define RTC_DAYS_PER_ERA 146097     // 400 Gregorian years
+
+static bool rtc_initialized = false;
+static volatile bool rtc_sync_pending = false;
+static ktimer_t rtc_resync_timer;
+static rtc_stats_t rtc_stats;
 
 static uint8_t rtc_read_register(uint8_t reg)
 {
@@ -28,6 +51,12 @@ static uint8_t rtc_read_register(uint8_t reg)
     return inb(CMOS_DATA);
 }
 
+static void rtc_write_register(uint8_t reg, uint8_t value)
+{
+    outb(CMOS_ADDRESS, reg);
+    outb(CMOS_DATA, value);
+}
+
 static uint8_t bcd_to_bin(uint8_t bcd)
 {
     return ((bcd >> 4) * 10) + (bcd & 0x0F);
@@ -36,14 +65,12 @@ static uint8_t bcd_to_bin(uint8_t bcd)
 static bool rtc_is_updating(void)
 {
     outb(CMOS_ADDRESS, RTC_STATUS_A);
-    return (inb(CMOS_DATA) & 0x80) != 0;
+    return (inb(CMOS_DATA) & RTC_UIP) != 0;
 }
 
-void rtc_init(void)
+// Read the clock registers; the caller makes sure no update is under way
+static void rtc_read_clock(rtc_time_t* time)
 {
-    // Wait for RTC to not be updating
-    while (rtc_is_updating());
-    
     // Read status register B
     uint8_t status_b = rtc_read_register(RTC_STATUS_B);
     bool use_24h = (status_b & RTC_24HOUR) != 0;
@@ -89,72 +116,148 @@ void rtc_init(void)
         }
     }
     
-    rtc_time.second = second;
-    rtc_time.minute = minute;
-    rtc_time.hour = hour;
-    rtc_time.day = day;
-    rtc_time.month = month;
-    rtc_time.year = year;
-    rtc_time.initialized = true;
+    time->second = second;
+    time->minute = minute;
+    time->hour = hour;
+    time->day = day;
+    time->month = month;
+    time->year = year;
+    time->initialized = true;
+}
+
+// Seconds since 1970 for a date in 2000-2099; counting years from March
+// puts the leap day last, so month lengths follow a fixed pattern
+static uint32_t rtc_time_to_epoch(const rtc_time_t* time)
+{
+    uint32_t year = 2000 + time->year - (time->month <= 2 ? 1 : 0);
+    uint32_t era = year / 400;
+    uint32_t year_of_era = year - era * 400;
+    uint32_t month = time->month > 2 ? time->month - 3 : time->month + 9;
+    uint32_t day_of_year = (153 * month + 2) / 5 + time->day - 1;
+    uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    uint32_t days = era * RTC_DAYS_PER_ERA + day_of_era - RTC_DAYS_TO_EPOCH;
+    
+    return days * 86400 + time->hour * 3600 + time->minute * 60 + time->second;
 }
 
-void rtc_get_time(rtc_time_t* time)
+static void rtc_epoch_to_time(uint32_t epoch, rtc_time_t* time)
 {
-    if (!rtc_time.initialized) {
-        rtc_init();
+    uint32_t days = epoch / 86400;
+    uint32_t seconds = epoch % 86400;
+    time->hour = seconds / 3600;
+    time->minute = (seconds / 60) % 60;
+    time->second = seconds % 60;
+    
+    days += RTC_DAYS_TO_EPOCH;
+    uint32_t era = days / RTC_DAYS_PER_ERA;
+    uint32_t day_of_era = days - era * RTC_DAYS_PER_ERA;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t month = (5 * day_of_year + 2) / 153;
+    uint32_t year = era * 400 + year_of_era;
+    
+    time->day = day_of_year - (153 * month + 2) / 5 + 1;
+    time->month = month < 10 ? month + 3 : month - 9;
+    if (time->month <= 2) year++;
+    time->year = year - 2000;
+    time->initialized = true;
+}
+
+// Ask for one update-ended interrupt
+static void rtc_request_sync(void)
+{
+    uint32_t irq = irq_save();
+    rtc_read_register(RTC_STATUS_C);
+    rtc_write_register(RTC_STATUS_B, rtc_read_register(RTC_STATUS_B) | RTC_UIE);
+    rtc_sync_pending = true;
+    irq_restore(irq);
+}
+
+// Step wall time to the RTC, keeping the offset for the stats
+static void rtc_set_wall(uint64_t real_ns)
+{
+    uint64_t before = ktime_get_real_ns();
+    timekeeping_set_real(real_ns);
+    
+    // div_u64 is unsigned; a step back is recorded as a negative offset
+    if (real_ns >= before) {
+        rtc_stats.last_offset_us = (int32_t)div_u64(real_ns - before, 1000);
+    } else {
+        rtc_stats.last_offset_us = -(int32_t)div_u64(before - real_ns, 1000);
     }
+}
+
+static void rtc_resync(void* arg)
+{
+    (void)arg;
     
+    // The last request went unanswered: IRQ8 is not reaching us
+    if (rtc_sync_pending) {
+        uint32_t irq = irq_save();
+        while (rtc_is_updating());
+        rtc_time_t time;
+        rtc_read_clock(&time);
+        
+        // Within the same second is as close as a read can tell
+        uint64_t now = ktime_get_real_ns();
+        uint32_t epoch = rtc_time_to_epoch(&time);
+        uint32_t wall = (uint32_t)div_u64(now, NSEC_PER_SEC);
+        if (wall != epoch) {
+            uint64_t fraction = now - (uint64_t)wall * NSEC_PER_SEC;
+            rtc_set_wall((uint64_t)epoch * NSEC_PER_SEC + fraction);
+        }
+        rtc_stats.polled_syncs++;
+        irq_restore(irq);
+    }
+    rtc_request_sync();
+}
+
+void rtc_init(void)
+{
     // Wait for RTC to not be updating
     while (rtc_is_updating());
     
-    // Read current time
-    uint8_t status_b = rtc_read_register(RTC_STATUS_B);
-    bool use_24h = (status_b & RTC_24HOUR) != 0;
-    bool use_binary = (status_b & RTC_BINARY) != 0;
+    rtc_time_t time;
+    rtc_read_clock(&time);
+    memset(&rtc_stats, 0, sizeof(rtc_stats));
+    timekeeping_set_real((uint64_t)rtc_time_to_epoch(&time) * NSEC_PER_SEC);
+    rtc_initialized = true;
     
-    uint8_t second = rtc_read_register(RTC_SECONDS);
-    uint8_t minute = rtc_read_register(RTC_MINUTES);
-    uint8_t hour = rtc_read_register(RTC_HOURS);
-    uint8_t day = rtc_read_register(RTC_DAY);
-    uint8_t month = rtc_read_register(RTC_MONTH);
-    uint8_t year = rtc_read_register(RTC_YEAR);
+    // Within a second the first interrupt pins down where the second began
+    rtc_request_sync();
+    ktimer_init(&rtc_resync_timer, rtc_resync, NULL);
+    ktimer_add_periodic(&rtc_resync_timer, RTC_RESYNC_MS);
+}
+
+// IRQ8: the registers were just updated and stay put for most of a second
+void rtc_handler(void)
+{
+    uint8_t status_c = rtc_read_register(RTC_STATUS_C);
+    if (!(status_c & RTC_UF) || !rtc_sync_pending) return;
     
-    // Convert BCD to binary if needed
-    if (!use_binary) {
-        second = bcd_to_bin(second);
-        minute = bcd_to_bin(minute);
-        day = bcd_to_bin(day);
-        month = bcd_to_bin(month);
-        year = bcd_to_bin(year);
-        
-        if (!use_24h) {
-            hour = bcd_to_bin(hour);
-            if (hour & 0x80) {
-                hour = ((hour & 0x7F) + 12) % 24;
-            } else {
-                hour = hour & 0x7F;
-                if (hour == 12) hour = 0;
-            }
-        } else {
-            hour = bcd_to_bin(hour);
-        }
-    } else {
-        if (!use_24h) {
-            if (hour & 0x80) {
-                hour = ((hour & 0x7F) + 12) % 24;
-            } else {
-                if (hour == 12) hour = 0;
-            }
-        }
+    rtc_write_register(RTC_STATUS_B, rtc_read_register(RTC_STATUS_B) & ~RTC_UIE);
+    rtc_sync_pending = false;
+    
+    rtc_time_t time;
+    rtc_read_clock(&time);
+    rtc_set_wall((uint64_t)rtc_time_to_epoch(&time) * NSEC_PER_SEC);
+    rtc_stats.irq_syncs++;
+}
+
+void rtc_get_time(rtc_time_t* time)
+{
+    if (!rtc_initialized) {
+        rtc_init();
     }
     
-    time->second = second;
-    time->minute = minute;
-    time->hour = hour;
-    time->day = day;
-    time->month = month;
-    time->year = year;
-    time->initialized = true;
+    timeval_t now;
+    gettimeofday(&now);
+    rtc_epoch_to_time(now.tv_sec, time);
+}
+
+void rtc_get_stats(rtc_stats_t* stats)
+{
+    *stats = rtc_stats;
 }
 
 // Get full year (assumes year 2000+)
@@ -1,6 +1,10 @@
 #include "drivers.h"
 #include "../kernel.h"
 #include "../lib/lib.h"
+#include "../cpu.h"
+#include "../memory/memory.h"
+
+#define VESA_BENCH_ROUNDS 8
 
 vesa_info_t vesa_info = {0};
 
@@ -17,26 +21,36 @@ static uint32_t rgb(uint8_t r, uint8_t g, uint8_t b)
     return (r << 16) | (g << 8) | b;
 }
 
-bool vesa_init(void)
+// Memory type used for the framebuffer mapping
+static uint32_t fb_cache_flags = PAGE_CACHE_UC;
+
+bool vesa_init(multiboot_info_t* mbi)
 {
-    // In a real implementation, we'd use VESA BIOS Extensions
-    // For now, use a simulated framebuffer at a fixed address
-    // In VirtualBox/QEMU, we can use the multiboot framebuffer info
+    // Only a linear 32-bit RGB framebuffer set up by the boot loader is supported
+    if (!mbi || !(mbi->flags & MULTIBOOT_INFO_FRAMEBUFFER))
+        return false;
+    if (mbi->framebuffer_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB || mbi->framebuffer_bpp != 32)
+        return false;
+    if (mbi->framebuffer_addr >> 32)
+        return false;
     
-    // Default resolution for compatibility
-    vesa_info.width = 1024;
-    vesa_info.height = 768;
-    vesa_info.pitch = 1024 * 4; // 32-bit color
-    vesa_info.bpp = 32;
+    vesa_info.width = mbi->framebuffer_width;
+    vesa_info.height = mbi->framebuffer_height;
+    vesa_info.pitch = mbi->framebuffer_pitch;
+    vesa_info.bpp = mbi->framebuffer_bpp;
     
-    // Try to use multiboot framebuffer if available
-    // For now, use a simulated framebuffer
-    vesa_info.framebuffer = (uint32_t*)0xFD000000; // Simulated address
+    // Map it write-combining so streaming stores are merged into bursts
+    uint32_t phys = (uint32_t)mbi->framebuffer_addr;
+    uint32_t size = vesa_info.pitch * vesa_info.height;
+    fb_cache_flags = pat_write_combining(phys, size);
+    vesa_info.framebuffer = (uint32_t*)paging_map_mmio(phys, size, fb_cache_flags);
+    if (!vesa_info.framebuffer)
+        return false;
+    
+    vesa_info.initialized = true;
     
     // Initialize with background color
     vesa_clear(COLOR_BG_DARK);
-    
-    vesa_info.initialized = true;
     return true;
 }
 
@@ -103,15 +117,36 @@ void vesa_clear(uint32_t color)
     if (!vesa_info.initialized || !vesa_info.framebuffer)
         return;
     
+    // Sequential stores, one row at a time
     for (uint32_t y = 0; y < vesa_info.height; y++) {
+        uint32_t* row = vesa_info.framebuffer + y * (vesa_info.pitch / 4);
         for (uint32_t x = 0; x < vesa_info.width; x++) {
-            vesa_set_pixel(x, y, color);
+            row[x] = color;
         }
     }
 }
 
+static uint32_t time_clears(uint32_t cache_flags)
+{
+    uint32_t size = vesa_info.pitch * vesa_info.height;
+    paging_set_cache(vesa_info.framebuffer, size, cache_flags);
+    vesa_clear(COLOR_BG_DARK);
+    
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < VESA_BENCH_ROUNDS; i++) {
+        vesa_clear(i & 1 ? COLOR_BG_LIGHT : COLOR_BG_DARK);
+    }
+    return (uint32_t)div_u64(rdtsc() - start, VESA_BENCH_ROUNDS);
+}
 
-
-
-
-
+// Time vesa_clear with the framebuffer mapped uncached and then write-combining
+bool vesa_benchmark(vesa_bench_t* result)
+{
+    if (!vesa_info.initialized || !vesa_info.framebuffer)
+        return false;
+    
+    result->bytes = vesa_info.pitch * vesa_info.height;
+    result->uc_cycles = time_clears(PAGE_CACHE_UC);
+    result->wc_cycles = time_clears(fb_cache_flags);
+    return true;
+}
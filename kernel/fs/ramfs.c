@@ -1,6 +1,8 @@
 #include "fs.h"
 #include "../lib/lib.h"
 #include "../memory/memory.h"
+#include "../kernel.h"
+#include "../cpu.h"
 
 #define MAX_FILES 256
 #define MAX_DIRS 64
@@ -19,11 +21,15 @@ typedef struct ramfs_entry {
     uint32_t children[16]; // Max 16 entries per directory
 } ramfs_entry_t;
 
+// Entries and their buffers change only inside irq_save: the shrinker runs
+// from the idle thread of any CPU, alongside the shell
 static ramfs_entry_t filesystem[MAX_FILES];
 static uint32_t num_entries = 0;
 static uint32_t current_dir = 0;
 static bool fs_initialized = false;
 
+static void ramfs_shrink(uint32_t target);
+
 void ramfs_init(void)
 {
     if (fs_initialized) return;
@@ -43,6 +49,8 @@ void ramfs_init(void)
     num_entries = 1;
     current_dir = 0;
     fs_initialized = true;
+    
+    shrinker_register("ramfs", ramfs_shrink, 20);
 }
 
 static uint32_t ramfs_find_entry_in_dir(uint32_t dir_id, const char* name)
@@ -69,10 +77,8 @@ static uint32_t ramfs_get_free_entry(void)
     return MAX_FILES; // No free entry
 }
 
-uint32_t ramfs_create_file(const char* path)
-{
-    if (!fs_initialized) ramfs_init();
-    
+static uint32_t ramfs_create_entry(const char* path)
+{    
     // Simple implementation: handle only current directory files for now
     char path_copy[MAX_PATH];
     strcpy(path_copy, path);
@@ -121,6 +127,16 @@ uint32_t ramfs_create_file(const char* path)
     return new_id;
 }
 
+uint32_t ramfs_create_file(const char* path)
+{
+    if (!fs_initialized) ramfs_init();
+    
+    uint32_t irq = irq_save();
+    uint32_t id = ramfs_create_entry(path);
+    irq_restore(irq);
+    return id;
+}
+
 uint32_t ramfs_create_directory(const char* path)
 {
     if (!fs_initialized) ramfs_init();
@@ -162,28 +178,80 @@ uint32_t ramfs_find_path(const char* path)
     return dir;
 }
 
+// Small files are packed into slab size classes, larger ones come from the heap
+static uint8_t* ramfs_alloc_data(uint32_t size, uint32_t* capacity)
+{
+    uint32_t class_size = kmem_size_class(size);
+    if (class_size) {
+        *capacity = class_size;
+        return (uint8_t*)kmem_alloc(class_size);
+    }
+    
+    // Allocate with extra space so appends do not reallocate every time
+    *capacity = size + 1024;
+    return (uint8_t*)kmalloc(size + 1024);
+}
+
+static void ramfs_free_data(ramfs_entry_t* entry)
+{
+    if (!entry->data) return;
+    
+    if (entry->capacity <= KMEM_MAX_CLASS) {
+        kmem_free(entry->data);
+    } else {
+        kfree(entry->data);
+    }
+    entry->data = NULL;
+    entry->capacity = 0;
+}
+
+// Shrinker: drop the append slack of heap-backed files and the buffers of empty ones
+static void ramfs_shrink(uint32_t target)
+{
+    UNUSED(target);
+    
+    uint32_t irq = irq_save();
+    for (uint32_t i = 0; i < MAX_FILES; i++) {
+        ramfs_entry_t* entry = &filesystem[i];
+        if (entry->name[0] == '\0' || entry->is_directory || !entry->data) continue;
+        
+        if (entry->size == 0) {
+            ramfs_free_data(entry);
+        } else if (entry->capacity > KMEM_MAX_CLASS && entry->capacity > entry->size) {
+            // Stay above the slab classes so ramfs_free_data still picks kfree
+            uint32_t capacity = entry->size > KMEM_MAX_CLASS ? entry->size : KMEM_MAX_CLASS + 1;
+            if (capacity < entry->capacity && krealloc(entry->data, capacity) == entry->data) {
+                entry->capacity = capacity;
+            }
+        }
+    }
+    irq_restore(irq);
+}
+
 bool ramfs_write_file(uint32_t file_id, const uint8_t* data, uint32_t size)
 {
     if (file_id >= MAX_FILES || filesystem[file_id].is_directory) return false;
     
     ramfs_entry_t* file = &filesystem[file_id];
+    uint32_t irq = irq_save();
     
     // Allocate or reallocate buffer
     if (file->capacity < size) {
-        if (file->data) {
-            // Free old memory before allocating new
-            kfree(file->data);
-        }
-        // Allocate new buffer with extra space
-        file->data = (uint8_t*)kmalloc(size + 1024);
+        // Free old memory before allocating new
+        ramfs_free_data(file);
+        
+        uint32_t capacity;
+        file->data = ramfs_alloc_data(size, &capacity);
         if (!file->data) {
+            irq_restore(irq);
             return false; // Allocation failed
         }
-        file->capacity = size + 1024;
+        file->capacity = capacity;
     }
     
     memcpy(file->data, data, size);
     file->size = size;
+    irq_restore(irq);
     return true;
 }
 
@@ -192,12 +260,14 @@ uint32_t ramfs_read_file(uint32_t file_id, uint8_t* buffer, uint32_t max_size)
     if (file_id >= MAX_FILES || filesystem[file_id].is_directory) return 0;
     
     ramfs_entry_t* file = &filesystem[file_id];
+    uint32_t irq = irq_save();
     uint32_t to_read = (max_size < file->size) ? max_size : file->size;
     
     if (file->data && to_read > 0) {
         memcpy(buffer, file->data, to_read);
     }
     
+    irq_restore(irq);
     return to_read;
 }
 
@@ -206,6 +276,7 @@ bool ramfs_delete_entry(uint32_t entry_id)
     if (entry_id == 0 || entry_id >= MAX_FILES) return false; // Can't delete root
     
     ramfs_entry_t* entry = &filesystem[entry_id];
+    uint32_t irq = irq_save();
     
     // Delete all children if it's a directory
     if (entry->is_directory) {
@@ -215,9 +286,7 @@ bool ramfs_delete_entry(uint32_t entry_id)
     }
     
     // Free data
-    if (entry->data) {
-        kfree(entry->data);
-    }
+    ramfs_free_data(entry);
     
     // Remove from parent
     if (entry->parent_dir < MAX_FILES) {
@@ -243,6 +312,7 @@ bool ramfs_delete_entry(uint32_t entry_id)
     }
     
     num_entries--;
+    irq_restore(irq);
     return true;
 }
 
@@ -1,10 +1,9 @@
 #include "kernel.h"
 #include "gdt.h"
+#include "smp.h"
+#include "lib/lib.h"
 
-struct gdt_entry gdt[5];
-struct gdt_ptr gp;
-
-void gdt_set_gate(int num, unsigned long base, unsigned long limit, unsigned char access, unsigned char gran)
+void gdt_set_gate(struct gdt_entry* gdt, int num, unsigned long base, unsigned long limit, unsigned char access, unsigned char gran)
 {
     gdt[num].base_low = (base & 0xFFFF);
     gdt[num].base_middle = (base >> 16) & 0xFF;
@@ -16,24 +15,35 @@ void gdt_set_gate(int num, unsigned long base, unsigned long limit, unsigned cha
     gdt[num].access = access;
 }
 
-extern void gdt_flush();
+extern void gdt_flush(struct gdt_ptr* gp);
 
-void gdt_init()
+// Load a GDT of the CPU's own: the flat segments, its TSS, and a data
+// segment over its cpu_t for gs
+void gdt_init_cpu(cpu_t* cpu)
 {
-    gp.limit = (sizeof(struct gdt_entry) * 5) - 1;
-    gp.base = (unsigned int)&gdt;
-
-    gdt_set_gate(0, 0, 0, 0, 0);                // Null segment
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF); // User mode code segment
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User mode data segment
-
-    gdt_flush();
+    struct gdt_entry* gdt = cpu->gdt;
+    cpu->gdt_ptr.limit = sizeof(cpu->gdt) - 1;
+    cpu->gdt_ptr.base = (unsigned int)gdt;
+
+    gdt_set_gate(gdt, 0, 0, 0, 0, 0);                // Null segment
+    gdt_set_gate(gdt, 1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Code segment
+    gdt_set_gate(gdt, 2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Data segment
+    gdt_set_gate(gdt, 3, 0, 0xFFFFFFFF, 0xFA, 0xCF); // User mode code segment
+    gdt_set_gate(gdt, 4, 0, 0xFFFFFFFF, 0xF2, 0xCF); // User mode data segment
+
+    memset(&cpu->tss, 0, sizeof(cpu->tss));
+    cpu->tss.ss0 = GDT_KERNEL_DATA;
+    cpu->tss.esp0 = cpu->stack_top;
+    cpu->tss.iomap_base = sizeof(cpu->tss);
+    gdt_set_gate(gdt, 5, (unsigned long)&cpu->tss, sizeof(cpu->tss) - 1, 0x89, 0x00); // TSS
+    gdt_set_gate(gdt, 6, (unsigned long)cpu, sizeof(cpu_t) - 1, 0x92, 0x40);        // Per-CPU data
+
+    gdt_flush(&cpu->gdt_ptr);
+    asm volatile("ltr %%ax" : : "a"(GDT_TSS));
+    asm volatile("mov %%ax, %%gs" : : "a"(GDT_PERCPU));
 }
 
-
-
-
-
-
+void gdt_init()
+{
+    gdt_init_cpu(smp_boot_cpu());
+}
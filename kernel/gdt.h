@@ -1,6 +1,15 @@
 #ifndef GDT_H
 #define GDT_H
 
+#include <stdint.h>
+
+// Segments; every CPU has its own GDT with this layout
+#define GDT_ENTRIES 7
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_TSS 0x28
+#define GDT_PERCPU 0x30     // Loaded into gs, based at the CPU's cpu_t
+
 struct gdt_entry
 {
     unsigned short limit_low;
@@ -17,12 +26,24 @@ struct gdt_ptr
     unsigned int base;
 } __attribute__((packed));
 
-void gdt_init();
-
-#endif
-
-
-
+// Only esp0 and ss0 matter: the stack for interrupts taken in ring 3
+struct tss_entry
+{
+    uint32_t prev_tss;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed));
 
+struct cpu;
 
+void gdt_init();
+void gdt_init_cpu(struct cpu* cpu);
 
+#endif
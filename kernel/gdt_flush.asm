@@ -1,17 +1,17 @@
 section .text
 global gdt_flush
-extern gp
 
+; void gdt_flush(struct gdt_ptr* gp)
 gdt_flush:
-    lgdt [gp]
+    mov eax, [esp + 4]
+    lgdt [eax]
     mov ax, 0x10      ; 0x10 is the offset in the GDT to our data segment
     mov ds, ax
     mov es, ax
     mov fs, ax
-    mov gs, ax
+    mov gs, ax        ; Replaced by the per-CPU segment once the TSS is loaded
     mov ss, ax
     jmp 0x08:.flush   ; 0x08 is the offset to our code segment: far jump
 .flush:
     ret
 
-
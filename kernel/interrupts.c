@@ -1,6 +1,7 @@
 #include "kernel.h"
 #include "interrupts.h"
 #include "lib/lib.h"
+#include "cpu.h"
 
 extern void kernel_panic(const char* message);
 
@@ -68,6 +69,10 @@ extern void irq12();
 extern void irq13();
 extern void irq14();
 extern void irq15();
+extern void irq16();
+extern void irq17();
+extern void irq18();
+extern void apic_spurious();
 extern void syscall_handler_asm();
 
 void idt_init()
@@ -129,6 +134,10 @@ void idt_init()
     idt_set_gate(45, (unsigned)irq13, 0x08, 0x8E);
     idt_set_gate(46, (unsigned)irq14, 0x08, 0x8E);
     idt_set_gate(47, (unsigned)irq15, 0x08, 0x8E);
+    idt_set_gate(48, (unsigned)irq16, 0x08, 0x8E);
+    idt_set_gate(49, (unsigned)irq17, 0x08, 0x8E);
+    idt_set_gate(50, (unsigned)irq18, 0x08, 0x8E);
+    idt_set_gate(255, (unsigned)apic_spurious, 0x08, 0x8E);
 
     // Remap PIC
     outb(0x20, 0x11);
@@ -148,36 +157,56 @@ void idt_init()
 // Global to store syscall return value
 int syscall_retval = 0;
 
+// Handlers run under the kernel lock, like any irq_save section
+static void isr_dispatch(registers_t* regs);
+
 void isr_handler(registers_t regs)
+{
+    uint32_t irq = irq_save();
+    isr_dispatch(&regs);
+    irq_restore(irq);
+}
+
+static void isr_dispatch(registers_t* regs)
 {
     // Handle system calls (interrupt 0x80 = 128)
-    if (regs.int_no == 128) {
+    if (regs->int_no == 128) {
         extern void syscall_handler(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t);
         extern int syscall_get_return(void);
-        syscall_handler(regs.eax, regs.ebx, regs.ecx, regs.edx, regs.esi);
+        syscall_handler(regs->eax, regs->ebx, regs->ecx, regs->edx, regs->esi);
         syscall_retval = syscall_get_return();
         // Return value stored in syscall_retval
         return;
     }
     
     // Handle exceptions
-    if (regs.int_no < 32 || regs.int_no == 128) {
+    if (regs->int_no < 32 || regs->int_no == 128) {
         // For now, just ignore most exceptions
         // In a full OS, you'd handle them properly
-        if (regs.int_no == 14) {
-            // Page fault - can happen during initialization
-            // Ignore for now
+        if (regs->int_no == 14) {
+            // Page fault - demand paging, or a panic if it cannot be resolved
+            extern void page_fault_handler(uint32_t err_code, uint32_t eip);
+            page_fault_handler(regs->err_code, regs->eip);
             return;
         }
         // Other exceptions - ignore for minimal OS
     }
 }
 
+static void irq_dispatch(registers_t* regs);
+
 void irq_handler(registers_t regs)
+{
+    uint32_t irq = irq_save();
+    irq_dispatch(&regs);
+    irq_restore(irq);
+}
+
+static void irq_dispatch(registers_t* regs)
 {
     // Handle interrupts
-    if (regs.int_no >= 32) {
-        unsigned char irq = regs.int_no - 32;
+    if (regs->int_no >= 32) {
+        unsigned char irq = regs->int_no - 32;
         
         if (irq == 0) {
             // Timer interrupt (PIT)
@@ -188,13 +217,37 @@ void irq_handler(registers_t regs)
             unsigned char scancode = inb(0x60);
             extern void keyboard_handler(uint8_t);
             keyboard_handler(scancode);
+        } else if (irq == 8) {
+            // RTC update-ended interrupt
+            extern void rtc_handler(void);
+            rtc_handler();
+        } else if (regs->int_no == 48) {
+            // Local APIC timer
+            extern void apic_timer_handler(void);
+            apic_timer_handler();
+        } else if (regs->int_no == 50) {
+            // TLB shootdown; the reschedule IPI (49) needs nothing but the
+            // sched_irq_exit below
+            extern void smp_tlb_handle(void);
+            smp_tlb_handle();
         }
         
-        // Send EOI to PIC
-        if (regs.int_no >= 40) {
-            outb(0xA0, 0x20);
+        // Send EOI: one store to the local APIC once it has replaced the PICs
+        extern bool apic_is_enabled(void);
+        extern void apic_eoi(void);
+        if (apic_is_enabled()) {
+            apic_eoi();
+        } else {
+            if (regs->int_no >= 40) {
+                outb(0xA0, 0x20);
+            }
+            outb(0x20, 0x20);
         }
-        outb(0x20, 0x20);
+        
+        // Preempt only after the EOI, or the PIC would hold back the next
+        // timer tick until this thread runs again
+        extern void sched_irq_exit(void);
+        sched_irq_exit();
     }
 }
 
@@ -57,6 +57,8 @@ ISR_NOERRCODE 31
 
 extern isr_handler
 
+; gs holds the per-CPU segment and fs is unused, so the stubs leave both alone
+
 isr_common_stub:
     pusha
     mov ax, ds
@@ -64,16 +66,12 @@ isr_common_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     
     call isr_handler
     
     pop eax
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     popa
     add esp, 8
     iret
@@ -103,6 +101,14 @@ IRQ  12,    44
 IRQ  13,    45
 IRQ  14,    46
 IRQ  15,    47
+IRQ  16,    48      ; Local APIC timer
+IRQ  17,    49      ; Reschedule IPI
+IRQ  18,    50      ; TLB shootdown IPI
+
+; The local APIC does not expect an EOI for a spurious interrupt
+global apic_spurious
+apic_spurious:
+    iret
 
 extern irq_handler
 
@@ -114,16 +120,12 @@ irq_common_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     
     call irq_handler
     
     pop ebx
     mov ds, bx
     mov es, bx
-    mov fs, bx
-    mov gs, bx
     popa
     add esp, 8
     iret
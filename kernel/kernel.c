@@ -1,4 +1,5 @@
 #include "kernel.h"
+#include "multiboot.h"
 #include "gdt.h"
 #include "interrupts.h"
 #include "memory/memory.h"
@@ -7,34 +8,9 @@
 #include "lib/lib.h"
 #include "syscalls/syscalls.h"
 #include "sys/logging.h"
-
-// Multiboot information structure
-typedef struct {
-    uint32_t flags;
-    uint32_t mem_lower;
-    uint32_t mem_upper;
-    uint32_t boot_device;
-    uint32_t cmdline;
-    uint32_t mods_count;
-    uint32_t mods_addr;
-    uint32_t num;
-    uint32_t size;
-    uint32_t addr;
-    uint32_t shndx;
-    uint32_t mmap_length;
-    uint32_t mmap_addr;
-    uint32_t drives_length;
-    uint32_t drives_addr;
-    uint32_t config_table;
-    uint32_t boot_loader_name;
-    uint32_t apm_table;
-    uint32_t vbe_control_info;
-    uint32_t vbe_mode_info;
-    uint32_t vbe_mode;
-    uint32_t vbe_interface_seg;
-    uint32_t vbe_interface_off;
-    uint32_t vbe_interface_len;
-} multiboot_info_t;
+#include "sched/sched.h"
+#include "time/time.h"
+#include "smp.h"
 
 static multiboot_info_t* mb_info = 0;
 
@@ -49,6 +25,23 @@ void kernel_panic(const char* message)
     asm volatile("hlt");
 }
 
+// True if option appears as a whole word on the boot loader's command line
+bool kernel_boot_option(const char* option)
+{
+    if (!mb_info || !(mb_info->flags & MULTIBOOT_INFO_CMDLINE)) return false;
+    
+    size_t length = strlen(option);
+    const char* cmdline = (const char*)mb_info->cmdline;
+    const char* match = strstr(cmdline, option);
+    while (match) {
+        bool starts = match == cmdline || match[-1] == ' ';
+        bool ends = match[length] == '\0' || match[length] == ' ';
+        if (starts && ends) return true;
+        match = strstr(match + 1, option);
+    }
+    return false;
+}
+
 void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
 {
     if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
@@ -116,7 +109,7 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize system calls
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("3/11");
+    terminal_writestring("3/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Initializing system calls...    ");
     syscalls_init();
@@ -124,29 +117,25 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     
-    // Initialize logging
+    // Initialize memory management
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("4/11");
+    terminal_writestring("4/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-    terminal_writestring("] Initializing logging...          ");
-    log_init();
-    log_info("kernel", "System logging initialized");
+    terminal_writestring("] Initializing memory...          ");
+    memory_init(mb_info);
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     
-    // Initialize memory management
-    uint32_t mem_size = 64 * 1024 * 1024; // 64MB default
-    if (mb_info && (mb_info->flags & 0x01)) {
-        mem_size = (mb_info->mem_upper + 1024) * 1024; // Convert to bytes
-    }
+    // Initialize logging; its buffer lives on the heap
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("5/11");
+    terminal_writestring("5/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-    terminal_writestring("] Initializing memory...          ");
-    memory_init(mem_size);
+    terminal_writestring("] Initializing logging...          ");
+    log_init();
+    log_info("kernel", "System logging initialized");
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
@@ -154,7 +143,7 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize keyboard
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("6/11");
+    terminal_writestring("6/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Initializing keyboard...        ");
     keyboard_init();
@@ -165,11 +154,28 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize PIT (timer)
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("7/11");
+    terminal_writestring("7/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Initializing timer...         ");
     extern void pit_init(void);
+    tick_init();
     pit_init();
+    clocksource_init();
+    apic_init();
+    hpet_init();
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    terminal_writeln("[OK]");
+    terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+    
+    // Start the scheduler; the code running now becomes the first thread,
+    // then the other CPUs join in
+    terminal_writestring("  [");
+    terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+    terminal_writestring("8/12");
+    terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
+    terminal_writestring("] Starting scheduler...           ");
+    sched_init();
+    smp_init();
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
@@ -177,7 +183,7 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize RTC (clock)
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("8/11");
+    terminal_writestring("9/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Initializing RTC...             ");
     rtc_init();
@@ -185,12 +191,14 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     
-    // VGA already initialized at boot, just confirm
+    // VGA already initialized at boot; pick up a linear framebuffer if the
+    // boot loader set one up
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("9/11");
+    terminal_writestring("10/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Graphics initialized...         ");
+    vesa_init(mb_info);
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     terminal_writeln("[OK]");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
@@ -198,7 +206,7 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize file system
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("10/11");
+    terminal_writestring("11/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Initializing file system...     ");
     extern void ramfs_init(void);
@@ -210,7 +218,7 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     // Initialize shell
     terminal_writestring("  [");
     terminal_setcolor(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-    terminal_writestring("11/11");
+    terminal_writestring("12/12");
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
     terminal_writestring("] Starting shell...               ");
     log_info("kernel", "Shell initialized");
@@ -237,10 +245,9 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
     terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
     shell_print_prompt();
     
-    // Main kernel loop
+    // Main kernel loop; the idle thread runs while this one waits for a key
     while (1) {
-        // Check for keyboard input
-        char c = keyboard_get_char();
+        char c = keyboard_wait_char();
         if (c != 0) {
             shell_process_input(c);
             
@@ -258,9 +265,6 @@ void kernel_main_multiboot(uint32_t magic, multiboot_info_t* mbi)
                 shell_print_prompt();
             }
         }
-        
-        // Small delay to prevent CPU spinning
-        asm volatile("pause");
     }
 }
 
@@ -50,6 +50,7 @@
 // Function declarations
 void kernel_main(void);
 void kernel_panic(const char* message);
+bool kernel_boot_option(const char* option);
 
 // Utility macros
 #define UNUSED(x) (void)(x)
@@ -28,6 +28,9 @@ void printf(const char* format, ...);
 int atoi(const char* str);
 char* itoa(int value, char* str, int base);
 
+// Math functions
+uint64_t div_u64(uint64_t dividend, uint32_t divisor);
+
 // Memory functions
 void* kmalloc(size_t size);
 void kfree(void* ptr);
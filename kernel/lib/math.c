@@ -0,0 +1,15 @@
+#include "lib.h"
+
+// 64-by-32 bit division without libgcc's __udivdi3
+uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+    uint32_t hi = (uint32_t)(dividend >> 32);
+    uint32_t lo = (uint32_t)dividend;
+    
+    uint32_t q_hi = hi / divisor;
+    uint32_t r = hi % divisor;
+    uint32_t q_lo;
+    asm("divl %2" : "=a"(q_lo), "=d"(r) : "rm"(divisor), "a"(lo), "d"(r));
+    
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
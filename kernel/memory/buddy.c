@@ -0,0 +1,194 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// The buddy allocator borrows naturally aligned chunks of 2^BUDDY_MAX_ORDER
+// frames from the frame bitmap, splits them on demand and hands a chunk back
+// once all of its pieces have been freed and merged again.
+
+#define BUDDY_NOT_FREE 0xFF
+#define BUDDY_CHUNK_SHIFT (BUDDY_MAX_ORDER + 12)
+#define BUDDY_CHUNK_COUNT (LOWMEM_LIMIT >> BUDDY_CHUNK_SHIFT)
+
+// Stored in the first bytes of every free block
+typedef struct {
+    uint32_t next;
+    uint32_t prev;
+} buddy_link_t;
+
+static uint8_t* block_order = NULL;     // Per frame: order of the free block it heads
+static uint32_t frame_limit = 0;
+static uint32_t free_lists[BUDDY_MAX_ORDER + 1];
+static uint32_t free_counts[BUDDY_MAX_ORDER + 1];
+static uint32_t buddy_free_pages = 0;
+static uint32_t chunk_owned[(BUDDY_CHUNK_COUNT + 31) / 32];     // Chunks borrowed from the bitmap
+
+static buddy_link_t* link_of(uint32_t phys)
+{
+    return (buddy_link_t*)phys;
+}
+
+static void list_push(uint32_t order, uint32_t phys)
+{
+    buddy_link_t* link = link_of(phys);
+    link->prev = 0;
+    link->next = free_lists[order];
+    if (link->next) link_of(link->next)->prev = phys;
+    free_lists[order] = phys;
+    
+    block_order[phys / PAGE_SIZE] = (uint8_t)order;
+    free_counts[order]++;
+    buddy_free_pages += 1u << order;
+}
+
+static void list_remove(uint32_t order, uint32_t phys)
+{
+    buddy_link_t* link = link_of(phys);
+    if (link->prev) {
+        link_of(link->prev)->next = link->next;
+    } else {
+        free_lists[order] = link->next;
+    }
+    if (link->next) link_of(link->next)->prev = link->prev;
+    
+    block_order[phys / PAGE_SIZE] = BUDDY_NOT_FREE;
+    free_counts[order]--;
+    buddy_free_pages -= 1u << order;
+}
+
+static void set_chunk_owned(uint32_t phys, bool owned)
+{
+    uint32_t chunk = phys >> BUDDY_CHUNK_SHIFT;
+    if (owned) {
+        chunk_owned[chunk / 32] |= 1u << (chunk % 32);
+    } else {
+        chunk_owned[chunk / 32] &= ~(1u << (chunk % 32));
+    }
+}
+
+// True if phys lies in a chunk the buddy lists currently manage
+bool buddy_owns(uint32_t phys)
+{
+    uint32_t chunk = phys >> BUDDY_CHUNK_SHIFT;
+    if (chunk >= BUDDY_CHUNK_COUNT) return false;
+    return (chunk_owned[chunk / 32] & (1u << (chunk % 32))) != 0;
+}
+
+void buddy_init(void)
+{
+    frame_limit = frame_get_limit();
+    block_order = (uint8_t*)kmalloc(frame_limit);
+    if (!block_order) {
+        kernel_panic("buddy_init: cannot allocate block map");
+        return;
+    }
+    memset(block_order, BUDDY_NOT_FREE, frame_limit);
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(free_counts, 0, sizeof(free_counts));
+    memset(chunk_owned, 0, sizeof(chunk_owned));
+    buddy_free_pages = 0;
+}
+
+static uint32_t buddy_alloc(uint32_t order)
+{
+    uint32_t current = order;
+    while (current <= BUDDY_MAX_ORDER && !free_lists[current]) {
+        current++;
+    }
+    
+    if (current > BUDDY_MAX_ORDER) {
+        uint32_t chunk = frame_claim_aligned(1u << BUDDY_MAX_ORDER, 0);
+        if (!chunk) {
+            // Too fragmented for a whole chunk; take exactly what was asked for
+            return frame_claim_aligned(1u << order, 0);
+        }
+        set_chunk_owned(chunk, true);
+        list_push(BUDDY_MAX_ORDER, chunk);
+        current = BUDDY_MAX_ORDER;
+    }
+    
+    uint32_t block = free_lists[current];
+    list_remove(current, block);
+    
+    // Split, keeping the lower half and freeing the upper one
+    while (current > order) {
+        current--;
+        list_push(current, block + (PAGE_SIZE << current));
+    }
+    return block;
+}
+
+// Allocate 2^order physically contiguous, naturally aligned frames; returns 0 on failure
+uint32_t alloc_pages(uint32_t order)
+{
+    if (order > BUDDY_MAX_ORDER || !block_order) return 0;
+    
+    uint32_t irq = irq_save();
+    uint32_t block = buddy_alloc(order);
+    irq_restore(irq);
+    return block;
+}
+
+static void buddy_free(uint32_t frame, uint32_t order)
+{
+    uint32_t phys = frame * PAGE_SIZE;
+    
+    // Blocks claimed straight from the bitmap when no chunk was free go back there
+    if (!buddy_owns(phys)) {
+        frame_release_range(phys, phys + (PAGE_SIZE << order));
+        return;
+    }
+    
+    // Merge with the buddy for as long as it is free at the same order
+    while (order < BUDDY_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1u << order);
+        if (buddy >= frame_limit || block_order[buddy] != order) break;
+        
+        list_remove(order, buddy * PAGE_SIZE);
+        frame &= ~(1u << order);
+        order++;
+    }
+    
+    // A fully merged chunk goes back to the frame bitmap
+    if (order == BUDDY_MAX_ORDER) {
+        set_chunk_owned(frame * PAGE_SIZE, false);
+        frame_release_range(frame * PAGE_SIZE, (frame + (1u << BUDDY_MAX_ORDER)) * PAGE_SIZE);
+        return;
+    }
+    list_push(order, frame * PAGE_SIZE);
+}
+
+void free_pages(uint32_t phys, uint32_t order)
+{
+    if (!phys || order > BUDDY_MAX_ORDER) return;
+    
+    uint32_t frame = phys / PAGE_SIZE;
+    if (frame & ((1u << order) - 1)) {
+        kernel_panic("free_pages: block is not aligned to its order");
+        return;
+    }
+    
+    uint32_t irq = irq_save();
+    buddy_free(frame, order);
+    irq_restore(irq);
+}
+
+uint32_t buddy_get_free_pages(void)
+{
+    return buddy_free_pages;
+}
+
+void buddy_get_info(buddy_info_t* info)
+{
+    for (uint32_t order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        info->free_blocks[order] = free_counts[order];
+        info->available_blocks[order] = frame_count_aligned(1u << order);
+        
+        // Every larger free buddy block could be split to serve this order
+        for (uint32_t larger = order; larger <= BUDDY_MAX_ORDER; larger++) {
+            info->available_blocks[order] += free_counts[larger] << (larger - order);
+        }
+    }
+    info->free_pages = buddy_free_pages;
+}
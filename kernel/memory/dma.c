@@ -0,0 +1,99 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Buffers for bus-master devices. They come straight from physical memory
+// as naturally aligned power-of-two blocks, so they are physically
+// contiguous, and since low memory is identity mapped the CPU sees them at
+// the same contiguous address the device uses. x86 DMA is cache coherent,
+// so the normal write-back mapping needs no flushing around transfers.
+
+static dma_stats_t dma_stats;
+
+// Smallest order whose block covers size bytes at the requested alignment
+static int32_t dma_order(uint32_t size, uint32_t align)
+{
+    if (size == 0 || (align & (align - 1))) return -1;
+    
+    uint32_t bytes = size > align ? size : align;
+    uint32_t order = 0;
+    while (((uint32_t)PAGE_SIZE << order) < bytes) {
+        if (++order > BUDDY_MAX_ORDER) return -1;
+    }
+    return (int32_t)order;
+}
+
+static uint32_t dma_claim(uint32_t order, uint32_t flags)
+{
+    if (flags & DMA_ZONE_ISA) {
+        // The buddy lists have no notion of zones; take it from the bitmap
+        return frame_claim_aligned(1u << order, DMA_ISA_LIMIT);
+    }
+    return alloc_pages(order);
+}
+
+void* dma_alloc(size_t size, uint32_t align, uint32_t flags, uint32_t* phys)
+{
+    int32_t order = dma_order(size, align);
+    if (order < 0) {
+        dma_stats.failures++;
+        return NULL;
+    }
+    
+    uint32_t block = dma_claim((uint32_t)order, flags);
+    if (!block && shrink_memory(1u << order)) {
+        block = dma_claim((uint32_t)order, flags);
+    }
+    if (!block) {
+        dma_stats.failures++;
+        return NULL;
+    }
+    
+    uint32_t pages = 1u << order;
+    memset((void*)block, 0, PAGE_SIZE << order);
+    
+    uint32_t irq = irq_save();
+    dma_stats.allocations++;
+    dma_stats.pages_in_use += pages;
+    if (block + (PAGE_SIZE << order) <= DMA_ISA_LIMIT) {
+        dma_stats.isa_pages_in_use += pages;
+    }
+    if (dma_stats.pages_in_use > dma_stats.peak_pages) {
+        dma_stats.peak_pages = dma_stats.pages_in_use;
+    }
+    irq_restore(irq);
+    
+    if (phys) *phys = block;
+    return (void*)block;
+}
+
+// size and align must match the dma_alloc call that returned buf
+void dma_free(void* buf, size_t size, uint32_t align)
+{
+    if (!buf) return;
+    
+    int32_t order = dma_order(size, align);
+    uint32_t block = (uint32_t)buf;
+    if (order < 0 || (block & ((PAGE_SIZE << order) - 1))) {
+        kernel_panic("dma_free: size or alignment does not match the buffer");
+        return;
+    }
+    
+    uint32_t pages = 1u << order;
+    uint32_t irq = irq_save();
+    dma_stats.frees++;
+    dma_stats.pages_in_use -= pages;
+    if (block + (PAGE_SIZE << order) <= DMA_ISA_LIMIT) {
+        dma_stats.isa_pages_in_use -= pages;
+    }
+    irq_restore(irq);
+    
+    // Blocks taken from the bitmap go back there, buddy blocks merge again
+    free_pages(block, (uint32_t)order);
+}
+
+void dma_get_stats(dma_stats_t* stats)
+{
+    *stats = dma_stats;
+}
@@ -0,0 +1,297 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// One bit per 4 KiB frame of identity-mapped low memory; 1 = in use
+#define FRAME_COUNT_MAX (LOWMEM_LIMIT / PAGE_SIZE)
+#define FRAME_BITMAP_WORDS (FRAME_COUNT_MAX / 32)
+
+#define FRAME_INDEX(addr) ((addr) / PAGE_SIZE)
+#define FRAME_WORD(frame) ((frame) / 32)
+#define FRAME_BIT(frame) ((frame) % 32)
+
+// Defined in linker.ld
+extern uint32_t kernel_start;
+extern uint32_t kernel_end;
+
+static uint32_t frame_bitmap[FRAME_BITMAP_WORDS];
+static uint32_t frame_words = 0;        // Words covering the highest usable frame
+static uint32_t frames_usable = 0;      // Frames reported available by the memory map
+static uint32_t frames_free = 0;
+static uint32_t next_free_word = 0;     // No free frame below this word
+
+static inline uint32_t find_first_zero(uint32_t word)
+{
+    uint32_t bit;
+    asm("bsf %1, %0" : "=r"(bit) : "r"(~word));
+    return bit;
+}
+
+static bool frame_test(uint32_t frame)
+{
+    return (frame_bitmap[FRAME_WORD(frame)] & (1u << FRAME_BIT(frame))) != 0;
+}
+
+static void frame_set(uint32_t frame)
+{
+    frame_bitmap[FRAME_WORD(frame)] |= 1u << FRAME_BIT(frame);
+    frames_free--;
+}
+
+static void frame_clear(uint32_t frame)
+{
+    frame_bitmap[FRAME_WORD(frame)] &= ~(1u << FRAME_BIT(frame));
+    frames_free++;
+    if (FRAME_WORD(frame) < next_free_word) {
+        next_free_word = FRAME_WORD(frame);
+    }
+}
+
+// Mark every frame touching [start, end) as in use
+static void frame_reserve(uint64_t start, uint64_t end)
+{
+    if (end > (uint64_t)FRAME_COUNT_MAX * PAGE_SIZE) end = (uint64_t)FRAME_COUNT_MAX * PAGE_SIZE;
+    
+    for (uint64_t addr = start & ~0xFFFull; addr < end; addr += PAGE_SIZE) {
+        uint32_t frame = FRAME_INDEX((uint32_t)addr);
+        if (!frame_test(frame)) {
+            frame_set(frame);
+        }
+    }
+}
+
+// Mark every frame fully inside [start, end) as free
+static void frame_add_region(uint64_t start, uint64_t end)
+{
+    start = (start + 0xFFF) & ~0xFFFull;
+    end &= ~0xFFFull;
+    if (end > (uint64_t)FRAME_COUNT_MAX * PAGE_SIZE) end = (uint64_t)FRAME_COUNT_MAX * PAGE_SIZE;
+    
+    // Less than a page, or entirely above what the bitmap covers
+    if (start >= end) return;
+    
+    for (uint64_t addr = start; addr < end; addr += PAGE_SIZE) {
+        uint32_t frame = FRAME_INDEX((uint32_t)addr);
+        if (frame_test(frame)) {
+            frame_clear(frame);
+            frames_usable++;
+        }
+    }
+    
+    uint32_t words = (FRAME_INDEX(end) + 31) / 32;
+    if (words > frame_words) {
+        frame_words = words;
+    }
+}
+
+void frame_init(multiboot_info_t* mbi)
+{
+    // Everything is reserved until the memory map says otherwise
+    memset(frame_bitmap, 0xFF, sizeof(frame_bitmap));
+    frames_free = 0;
+    frames_usable = 0;
+    frame_words = 0;
+    
+    if (mbi && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        uint32_t entry_addr = mbi->mmap_addr;
+        while (entry_addr < mbi->mmap_addr + mbi->mmap_length) {
+            multiboot_mmap_entry_t* entry = (multiboot_mmap_entry_t*)entry_addr;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
+                frame_add_region(entry->addr, entry->addr + entry->len);
+            }
+            entry_addr += entry->size + sizeof(entry->size);
+        }
+    } else if (mbi && (mbi->flags & MULTIBOOT_INFO_MEMORY)) {
+        frame_add_region(0x100000, 0x100000 + (uint64_t)mbi->mem_upper * 1024);
+    } else {
+        frame_add_region(0x100000, 64 * 1024 * 1024);
+    }
+    
+    // Real-mode IVT, BIOS data, EBDA, VGA memory and the BIOS ROM
+    frame_reserve(0, 0x100000);
+    
+    // The kernel image itself
+    frame_reserve((uint32_t)&kernel_start, (uint32_t)&kernel_end);
+    
+    // Multiboot structures handed over by the boot loader
+    if (mbi) {
+        frame_reserve((uint32_t)mbi, (uint32_t)mbi + sizeof(multiboot_info_t));
+        if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+            frame_reserve(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+        }
+        if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+            frame_reserve(mbi->cmdline, mbi->cmdline + strlen((const char*)mbi->cmdline) + 1);
+        }
+        if (mbi->flags & MULTIBOOT_INFO_MODS) {
+            multiboot_module_t* mods = (multiboot_module_t*)mbi->mods_addr;
+            frame_reserve(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+            for (uint32_t i = 0; i < mbi->mods_count; i++) {
+                frame_reserve(mods[i].mod_start, mods[i].mod_end);
+                if (mods[i].cmdline) {
+                    frame_reserve(mods[i].cmdline, mods[i].cmdline + strlen((const char*)mods[i].cmdline) + 1);
+                }
+            }
+        }
+    }
+    
+    next_free_word = 0;
+}
+
+// Allocate one frame; returns its physical address or 0 if memory is exhausted
+uint32_t frame_alloc(void)
+{
+    uint32_t irq = irq_save();
+    for (uint32_t i = next_free_word; i < frame_words; i++) {
+        if (frame_bitmap[i] != 0xFFFFFFFF) {
+            uint32_t frame = i * 32 + find_first_zero(frame_bitmap[i]);
+            frame_set(frame);
+            next_free_word = i;
+            shrink_check();
+            irq_restore(irq);
+            return frame * PAGE_SIZE;
+        }
+    }
+    
+    next_free_word = frame_words;
+    shrink_check();
+    irq_restore(irq);
+    
+    // The bitmap is exhausted; the buddy allocator may still hold split blocks
+    return alloc_pages(0);
+}
+
+void frame_free(uint32_t phys)
+{
+    uint32_t frame = FRAME_INDEX(phys);
+    if (frame >= FRAME_COUNT_MAX || !frame_test(frame)) {
+        kernel_panic("frame_free: frame is not allocated");
+        return;
+    }
+    
+    // Frames served from a buddy chunk have to be merged back into it
+    if (buddy_owns(phys)) {
+        free_pages(phys & PAGE_FRAME_MASK, 0);
+        return;
+    }
+    uint32_t irq = irq_save();
+    frame_clear(frame);
+    irq_restore(irq);
+}
+
+// Take ownership of a specific range of frames; fails if any of them is in use
+bool frame_claim_range(uint32_t start, uint32_t end)
+{
+    start &= 0xFFFFF000;
+    uint32_t irq = irq_save();
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        if (frame_test(FRAME_INDEX(addr))) {
+            irq_restore(irq);
+            return false;
+        }
+    }
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        frame_set(FRAME_INDEX(addr));
+    }
+    irq_restore(irq);
+    return true;
+}
+
+static uint32_t claim_aligned(uint32_t count, uint32_t limit)
+{
+    uint32_t words = frame_words;
+    if (limit && FRAME_INDEX(limit) / 32 < words) {
+        words = FRAME_INDEX(limit) / 32;
+    }
+    
+    uint32_t first = 0;
+    if (count >= 32) {
+        // Whole words: look for count / 32 consecutive empty words
+        uint32_t run = count / 32;
+        uint32_t i;
+        for (i = 0; i + run <= words; i += run) {
+            uint32_t j = 0;
+            while (j < run && frame_bitmap[i + j] == 0) j++;
+            if (j == run) break;
+        }
+        if (i + run > words) return 0;
+        first = i * 32;
+    } else {
+        uint32_t mask = (1u << count) - 1;
+        uint32_t i;
+        uint32_t bit = 32;
+        for (i = next_free_word; i < words; i++) {
+            uint32_t word = frame_bitmap[i];
+            if (word == 0xFFFFFFFF) continue;
+            for (bit = 0; bit < 32; bit += count) {
+                if ((word & (mask << bit)) == 0) break;
+            }
+            if (bit < 32) break;
+        }
+        if (i >= words) return 0;
+        first = i * 32 + bit;
+    }
+    
+    for (uint32_t frame = first; frame < first + count; frame++) {
+        frame_set(frame);
+    }
+    return first * PAGE_SIZE;
+}
+
+// Claim a naturally aligned run of count frames (a power of two) below limit, 0 = anywhere
+uint32_t frame_claim_aligned(uint32_t count, uint32_t limit)
+{
+    uint32_t irq = irq_save();
+    uint32_t phys = claim_aligned(count, limit);
+    irq_restore(irq);
+    return phys;
+}
+
+// Number of naturally aligned free runs of count frames still in the bitmap
+uint32_t frame_count_aligned(uint32_t count)
+{
+    uint32_t total = 0;
+    
+    if (count >= 32) {
+        uint32_t run = count / 32;
+        for (uint32_t i = 0; i + run <= frame_words; i += run) {
+            uint32_t j = 0;
+            while (j < run && frame_bitmap[i + j] == 0) j++;
+            if (j == run) total++;
+        }
+    } else {
+        uint32_t mask = (1u << count) - 1;
+        for (uint32_t i = 0; i < frame_words; i++) {
+            uint32_t word = frame_bitmap[i];
+            if (word == 0xFFFFFFFF) continue;
+            for (uint32_t bit = 0; bit < 32; bit += count) {
+                if ((word & (mask << bit)) == 0) total++;
+            }
+        }
+    }
+    return total;
+}
+
+void frame_release_range(uint32_t start, uint32_t end)
+{
+    start &= 0xFFFFF000;
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        frame_free(addr);
+    }
+}
+
+uint32_t frame_get_free_count(void)
+{
+    return frames_free;
+}
+
+uint32_t frame_get_usable_count(void)
+{
+    return frames_usable;
+}
+
+// One past the highest frame the memory map reported as usable
+uint32_t frame_get_limit(void)
+{
+    return frame_words * 32;
+}
@@ -1,109 +1,712 @@
 #include "memory.h"
 #include "../lib/lib.h"
 #include "../kernel.h"
+#include "../cpu.h"
 
-static uint32_t heap_place = KHEAP_START;
-static uint32_t heap_max = KHEAP_START + KHEAP_INITIAL_SIZE;
+// Smallest block worth keeping as a separate hole
+#define HEAP_OVERHEAD (sizeof(heap_header_t) + sizeof(heap_footer_t))
+#define HEAP_MIN_BLOCK (HEAP_OVERHEAD + 16)
 
-typedef struct ordered_array {
-    void** array;
-    uint32_t size;
-    uint32_t max_size;
-    int (*predicate)(void*, void*);
-} ordered_array_t;
+// Holes at the end of the heap larger than this are given back
+#define HEAP_CONTRACT_THRESHOLD (8 * PAGE_SIZE)
+#define HEAP_CONTRACT_SLACK (4 * PAGE_SIZE)
+
+// Freed blocks at least this large hand their whole pages back
+#define HEAP_RELEASE_THRESHOLD (8 * PAGE_SIZE)
+
+// Defined in linker.ld
+extern uint32_t kernel_end;
+
+// Bump allocator used before the kernel heap exists
+static uint32_t placement_address = 0;
+
+heap_t* kheap = 0;
+
+// Allocation tracking; a site id is (generation << 8) | (slot + 1) so blocks
+// tracked before a reset are recognised and ignored when freed
+static bool track_enabled = false;
+static uint8_t track_generation = 1;
+static heap_site_t track_sites[HEAP_TRACK_SITES];
+static heap_track_summary_t track_summary;
 
 int standard_lessthan_predicate(void* a, void* b)
 {
     return (uint32_t)a < (uint32_t)b;
 }
 
-ordered_array_t heap_index;
+static int header_lessthan_predicate(void* a, void* b)
+{
+    return ((heap_header_t*)a)->size < ((heap_header_t*)b)->size;
+}
+
+ordered_array_t place_ordered_array(void* addr, uint32_t max_size, lessthan_predicate_t less_than)
+{
+    ordered_array_t to_ret;
+    // Slots past size are never read, so the array is left untouched and
+    // its pages are only populated as it fills up
+    to_ret.array = (void**)addr;
+    to_ret.size = 0;
+    to_ret.max_size = max_size;
+    to_ret.predicate = less_than;
+    return to_ret;
+}
+
+// Index of the first element that is not less than item
+static uint32_t ordered_array_lower_bound(ordered_array_t* array, void* item)
+{
+    uint32_t lo = 0;
+    uint32_t hi = array->size;
+    
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (array->predicate(array->array[mid], item)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-void heap_init()
+bool insert_ordered_array(void* item, ordered_array_t* array)
 {
-    uint32_t end = (uint32_t)heap_place + KHEAP_INITIAL_SIZE;
-    heap_max = end;
+    if (array->size >= array->max_size) return false;
     
-    // Simple placeholder - full implementation would use ordered_array
-    // For now, use a simple allocation strategy
+    uint32_t i = ordered_array_lower_bound(array, item);
+    memmove(&array->array[i + 1], &array->array[i], (array->size - i) * sizeof(void*));
+    array->array[i] = item;
+    array->size++;
+    return true;
 }
 
-uint32_t find_smallest_hole(uint32_t size, uint8_t page_align)
+void* lookup_ordered_array(uint32_t i, ordered_array_t* array)
 {
-    // Simplified implementation
-    // In a full OS, this would search the heap index
-    return heap_place;
+    if (i >= array->size) return NULL;
+    return array->array[i];
 }
 
-void expand(uint32_t new_size)
+void remove_ordered_array(uint32_t i, ordered_array_t* array)
 {
-    if (new_size <= heap_max - heap_place)
-        return;
+    if (i >= array->size) return;
+    
+    memmove(&array->array[i], &array->array[i + 1], (array->size - i - 1) * sizeof(void*));
+    array->size--;
+}
+
+// Remove a specific element; its sort key must not have changed since insertion
+static bool remove_item_ordered_array(void* item, ordered_array_t* array)
+{
+    uint32_t i = ordered_array_lower_bound(array, item);
     
-    // For now, just extend heap_max
-    heap_max = heap_place + new_size;
+    while (i < array->size && !array->predicate(item, array->array[i])) {
+        if (array->array[i] == item) {
+            remove_ordered_array(i, array);
+            return true;
+        }
+        i++;
+    }
+    return false;
+}
+
+static heap_footer_t* block_footer(heap_header_t* header)
+{
+    return (heap_footer_t*)((uint32_t)header + header->size - sizeof(heap_footer_t));
+}
+
+// Write the boundary tags for a block
+static heap_header_t* write_block(uint32_t addr, uint32_t size, uint8_t is_hole)
+{
+    heap_header_t* header = (heap_header_t*)addr;
+    header->magic = HEAP_MAGIC;
+    header->is_hole = is_hole;
+    header->site = 0;
+    header->size = size;
+    
+    heap_footer_t* footer = block_footer(header);
+    footer->magic = HEAP_MAGIC;
+    footer->header = header;
+    return header;
+}
+
+static bool block_is_valid(heap_header_t* header)
+{
+    return header->magic == HEAP_MAGIC && block_footer(header)->magic == HEAP_MAGIC;
+}
+
+// Full block size (tags included) needed for a payload of size bytes
+static uint32_t block_size_for(uint32_t size)
+{
+    uint32_t block = (size + HEAP_OVERHEAD + 3) & ~3u;
+    return block < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : block;
+}
+
+// Bytes to skip at the start of a hole so the payload lands on an align boundary
+static uint32_t align_offset(uint32_t location, uint32_t align)
+{
+    uint32_t payload = location + sizeof(heap_header_t);
+    if (align == 0 || (payload & (align - 1)) == 0) return 0;
+    
+    uint32_t offset = align - (payload & (align - 1));
+    // The skipped fragment has to be able to stand as a hole of its own
+    while (offset < HEAP_MIN_BLOCK) offset += align;
+    return offset;
+}
+
+static int32_t find_smallest_hole(uint32_t size, uint32_t align, heap_t* heap)
+{
+    // Holes are sorted by size, so the first one that fits is the best fit
+    heap_header_t key;
+    key.size = size;
+    
+    for (uint32_t i = ordered_array_lower_bound(&heap->index, &key); i < heap->index.size; i++) {
+        heap_header_t* header = (heap_header_t*)lookup_ordered_array(i, &heap->index);
+        uint32_t needed = size + align_offset((uint32_t)header, align);
+        if (header->size >= needed) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+// A hole missing from the index could never be allocated or merged again,
+// so a full index is fatal rather than a silent leak
+static void insert_hole(heap_t* heap, uint32_t addr, uint32_t size)
+{
+    heap_header_t* hole = write_block(addr, size, 1);
+    if (!insert_ordered_array((void*)hole, &heap->index)) {
+        kernel_panic("heap: hole index full, HEAP_INDEX_SIZE too small");
+    }
 }
 
-uint32_t contract(uint32_t new_size)
+static uint32_t heap_page_flags(heap_t* heap)
 {
-    if (new_size >= heap_max - heap_place)
+    uint32_t flags = PAGE_PRESENT;
+    if (!heap->readonly) flags |= PAGE_WRITE;
+    if (!heap->supervisor) flags |= PAGE_USER;
+    return flags;
+}
+
+// Give back the frames behind [start, end) and drop their mappings; returns pages freed
+static uint32_t unmap_pages(uint32_t start, uint32_t end)
+{
+    uint32_t freed = 0;
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        uint32_t phys = paging_unmap_page((void*)addr);
+        if (phys) {
+            frame_free(phys);
+            freed++;
+        }
+    }
+    vma_heap_released(freed);
+    return freed;
+}
+
+// The heap's address range is populated lazily by the page-fault handler,
+// so growing it is pure bookkeeping
+static bool expand(uint32_t new_size, heap_t* heap)
+{
+    new_size = (new_size + 0xFFF) & 0xFFFFF000;
+    if (heap->start_address + new_size > heap->max_address) {
+        return false;
+    }
+    
+    heap->end_address = heap->start_address + new_size;
+    return true;
+}
+
+static uint32_t contract(uint32_t new_size, heap_t* heap)
+{
+    new_size = (new_size + 0xFFF) & 0xFFFFF000;
+    if (new_size < HEAP_MIN_SIZE) {
+        new_size = HEAP_MIN_SIZE;
+    }
+    if (new_size < heap->end_address - heap->start_address) {
+        uint32_t new_end = heap->start_address + new_size;
+        unmap_pages(new_end, heap->end_address);
+        heap->end_address = new_end;
+    }
+    return heap->end_address - heap->start_address;
+}
+
+// Grow the heap by at least min_size bytes and merge the new space into the last hole
+static bool heap_grow(heap_t* heap, uint32_t min_size)
+{
+    uint32_t old_end = heap->end_address;
+    if (!expand(old_end - heap->start_address + min_size, heap)) {
+        return false;
+    }
+    
+    heap_footer_t* last_footer = (heap_footer_t*)(old_end - sizeof(heap_footer_t));
+    heap_header_t* last = last_footer->header;
+    if (last->is_hole) {
+        remove_item_ordered_array((void*)last, &heap->index);
+        insert_hole(heap, (uint32_t)last, heap->end_address - (uint32_t)last);
+    } else {
+        insert_hole(heap, old_end, heap->end_address - old_end);
+    }
+    return true;
+}
+
+heap_t* create_heap(uint32_t start, uint32_t end, uint32_t max, uint8_t supervisor, uint8_t readonly)
+{
+    // The heap descriptor and its index live at the bottom of the region
+    heap_t* heap = (heap_t*)start;
+    start += sizeof(heap_t);
+    heap->index = place_ordered_array((void*)start, HEAP_INDEX_SIZE, header_lessthan_predicate);
+    start += sizeof(void*) * HEAP_INDEX_SIZE;
+    start = (start + 0xFFF) & 0xFFFFF000;
+    
+    heap->start_address = start;
+    heap->end_address = end;
+    heap->max_address = max;
+    heap->supervisor = supervisor;
+    heap->readonly = readonly;
+    
+    // Start out with one hole covering everything
+    insert_hole(heap, start, end - start);
+    return heap;
+}
+
+// Allocate size bytes whose address is a multiple of align (a power of two, or 0)
+void* heap_alloc_aligned(heap_t* heap, uint32_t size, uint32_t align)
+{
+    uint32_t new_size = block_size_for(size);
+    int32_t iterator = find_smallest_hole(new_size, align, heap);
+    
+    if (iterator == -1) {
+        uint32_t grow = new_size + (align ? align + HEAP_MIN_BLOCK : 0);
+        if (!heap_grow(heap, grow)) {
+            return NULL;
+        }
+        return heap_alloc_aligned(heap, size, align);
+    }
+    
+    heap_header_t* hole = (heap_header_t*)lookup_ordered_array((uint32_t)iterator, &heap->index);
+    uint32_t hole_pos = (uint32_t)hole;
+    uint32_t hole_size = hole->size;
+    remove_ordered_array((uint32_t)iterator, &heap->index);
+    
+    uint32_t offset = align_offset(hole_pos, align);
+    if (offset) {
+        insert_hole(heap, hole_pos, offset);
+        hole_pos += offset;
+        hole_size -= offset;
+    }
+    
+    // Split off the remainder if it can stand as a hole
+    if (hole_size - new_size >= HEAP_MIN_BLOCK) {
+        insert_hole(heap, hole_pos + new_size, hole_size - new_size);
+    } else {
+        new_size = hole_size;
+    }
+    
+    write_block(hole_pos, new_size, 0);
+    return (void*)(hole_pos + sizeof(heap_header_t));
+}
+
+void* heap_alloc(heap_t* heap, uint32_t size, uint8_t page_align)
+{
+    return heap_alloc_aligned(heap, size, page_align ? PAGE_SIZE : 0);
+}
+
+// Drop the frames behind a large hole; they fault back in zeroed when reused
+static uint32_t release_hole_pages(uint32_t hole, uint32_t hole_size, uint32_t block, uint32_t block_size)
+{
+    // The pages holding the hole's boundary tags stay
+    uint32_t first = (hole + sizeof(heap_header_t) + 0xFFF) & 0xFFFFF000;
+    uint32_t last = (hole + hole_size - sizeof(heap_footer_t)) & 0xFFFFF000;
+    
+    // Only walk the pages the freed block covered, so freeing into a big
+    // hole stays cheap
+    uint32_t lo = block & 0xFFFFF000;
+    uint32_t hi = (block + block_size + 0xFFF) & 0xFFFFF000;
+    if (first < lo) first = lo;
+    if (last > hi) last = hi;
+    
+    if (first >= last) return 0;
+    return unmap_pages(first, last);
+}
+
+void heap_free(heap_t* heap, void* p)
+{
+    if (!p) return;
+    
+    heap_header_t* header = (heap_header_t*)((uint32_t)p - sizeof(heap_header_t));
+    if (!block_is_valid(header) || header->is_hole) {
+        kernel_panic("kfree: invalid pointer or heap corruption");
         return;
+    }
+    
+    uint32_t pos = (uint32_t)header;
+    uint32_t size = header->size;
+    uint32_t freed = pos;
+    uint32_t freed_size = size;
+    
+    // Coalesce with the block to the left
+    if (pos > heap->start_address) {
+        heap_footer_t* left_footer = (heap_footer_t*)(pos - sizeof(heap_footer_t));
+        heap_header_t* left = left_footer->header;
+        if (left_footer->magic == HEAP_MAGIC && left->magic == HEAP_MAGIC && left->is_hole) {
+            remove_item_ordered_array((void*)left, &heap->index);
+            pos = (uint32_t)left;
+            size += left->size;
+        }
+    }
     
-    heap_max = heap_place + new_size;
-    return new_size;
+    // Coalesce with the block to the right
+    if (pos + size < heap->end_address) {
+        heap_header_t* right = (heap_header_t*)(pos + size);
+        if (right->magic == HEAP_MAGIC && right->is_hole) {
+            remove_item_ordered_array((void*)right, &heap->index);
+            size += right->size;
+        }
+    }
+    
+    // Give the tail of the heap back once it is mostly free
+    if (pos + size == heap->end_address && size >= HEAP_CONTRACT_THRESHOLD) {
+        contract(pos - heap->start_address + HEAP_MIN_BLOCK + HEAP_CONTRACT_SLACK, heap);
+        size = heap->end_address - pos;
+    }
+    
+    if (freed_size >= HEAP_RELEASE_THRESHOLD) {
+        release_hole_pages(pos, size, freed, freed_size);
+    }
+    insert_hole(heap, pos, size);
 }
 
-void* kmalloc_int(uint32_t size, int align, uint32_t* phys)
+void* heap_realloc(heap_t* heap, void* p, uint32_t size)
+{
+    if (!p) return heap_alloc(heap, size, 0);
+    if (size == 0) {
+        heap_free(heap, p);
+        return NULL;
+    }
+    
+    heap_header_t* header = (heap_header_t*)((uint32_t)p - sizeof(heap_header_t));
+    if (!block_is_valid(header) || header->is_hole) {
+        kernel_panic("krealloc: invalid pointer or heap corruption");
+        return NULL;
+    }
+    
+    uint32_t pos = (uint32_t)header;
+    uint32_t new_size = block_size_for(size);
+    
+    // Shrink in place, handing the tail back if it is worth keeping
+    if (new_size <= header->size) {
+        uint32_t tail_size = header->size - new_size;
+        if (tail_size >= HEAP_MIN_BLOCK) {
+            write_block(pos, new_size, 0);
+            write_block(pos + new_size, tail_size, 0);
+            heap_free(heap, (void*)(pos + new_size + sizeof(heap_header_t)));
+        }
+        return p;
+    }
+    
+    // Grow in place by absorbing the hole to the right
+    uint32_t next = pos + header->size;
+    if (next < heap->end_address) {
+        heap_header_t* right = (heap_header_t*)next;
+        uint32_t total = header->size + right->size;
+        if (right->is_hole && total >= new_size) {
+            remove_item_ordered_array((void*)right, &heap->index);
+            if (total - new_size >= HEAP_MIN_BLOCK) {
+                insert_hole(heap, pos + new_size, total - new_size);
+            } else {
+                new_size = total;
+            }
+            write_block(pos, new_size, 0);
+            return p;
+        }
+    }
+    
+    void* moved = heap_alloc(heap, size, 0);
+    if (!moved) return NULL;
+    
+    memcpy(moved, p, header->size - HEAP_OVERHEAD);
+    heap_free(heap, p);
+    return moved;
+}
+
+void heap_get_stats(heap_stats_t* stats)
 {
-    if (heap_place == 0) {
-        heap_init();
+    memset(stats, 0, sizeof(heap_stats_t));
+    if (!kheap) return;
+    
+    stats->heap_size = kheap->end_address - kheap->start_address;
+    
+    uint32_t addr = kheap->start_address;
+    while (addr < kheap->end_address) {
+        heap_header_t* header = (heap_header_t*)addr;
+        if (header->magic != HEAP_MAGIC || header->size == 0) break;
+        
+        if (header->is_hole) {
+            stats->free_bytes += header->size;
+            stats->hole_count++;
+            if (header->size > stats->largest_hole) {
+                stats->largest_hole = header->size;
+            }
+        } else {
+            stats->used_bytes += header->size;
+            stats->alloc_count++;
+        }
+        addr += header->size;
     }
+}
+
+// Release the pages inside every hole, however small; returns pages freed
+uint32_t heap_trim(void)
+{
+    if (!kheap) return 0;
     
-    uint32_t new_location = heap_place;
+    uint32_t irq = irq_save();
+    uint32_t freed = 0;
+    for (uint32_t i = 0; i < kheap->index.size; i++) {
+        heap_header_t* hole = (heap_header_t*)lookup_ordered_array(i, &kheap->index);
+        freed += release_hole_pages((uint32_t)hole, hole->size, (uint32_t)hole, hole->size);
+    }
+    irq_restore(irq);
+    return freed;
+}
+
+void heap_init(void)
+{
+    // Whatever the placement allocator handed out stays in use for good
+    if (placement_address > (uint32_t)&kernel_end) {
+        frame_claim_range(((uint32_t)&kernel_end + 0xFFF) & 0xFFFFF000, placement_address);
+    }
     
-    if (align == 1 && (heap_place & 0xFFFFF000)) {
-        new_location &= 0xFFFFF000;
-        new_location += 0x1000;
+    uint32_t size = sizeof(heap_t) + sizeof(void*) * HEAP_INDEX_SIZE;
+    size = ((size + 0xFFF) & 0xFFFFF000) + KHEAP_INITIAL_SIZE;
+    
+    // Nothing is mapped yet; create_heap's first writes fault the pages in
+    kheap = create_heap(KHEAP_START, KHEAP_START + size, KHEAP_MAX_ADDRESS, 1, 0);
+}
+
+// Back a heap page on first touch; false if addr is outside the heap or memory is exhausted
+bool heap_populate_page(uint32_t addr)
+{
+    // create_heap's own writes fault before kheap is set
+    uint32_t end = kheap ? kheap->end_address : KHEAP_MAX_ADDRESS;
+    uint32_t flags = kheap ? heap_page_flags(kheap) : PAGE_PRESENT | PAGE_WRITE;
+    if (addr < KHEAP_START || addr >= end) {
+        return false;
+    }
+    
+    // Zeroed through the identity map, so read-only heaps work too
+    uint32_t phys = zero_page_alloc();
+    if (!phys) return false;
+    
+    if (!paging_map(addr & 0xFFFFF000, phys, flags)) {
+        frame_free(phys);
+        return false;
+    }
+    return true;
+}
+
+void* kmalloc_int(uint32_t size, int align, uint32_t* phys)
+{
+    if (kheap) {
+        void* addr = heap_alloc(kheap, size, (uint8_t)align);
+        if (!addr && shrink_memory(size / PAGE_SIZE + 1)) {
+            addr = heap_alloc(kheap, size, (uint8_t)align);
+        }
+        if (phys && addr) {
+            // The payload's page may not have been touched yet
+            *(volatile uint8_t*)addr;
+            *phys = paging_get_physical(addr);
+        }
+        return addr;
     }
     
+    // Early boot: bump allocate from the end of the kernel image
+    if (placement_address == 0) {
+        placement_address = (uint32_t)&kernel_end;
+    }
+    if (align == 1 && (placement_address & 0xFFF)) {
+        placement_address &= 0xFFFFF000;
+        placement_address += 0x1000;
+    }
     if (phys) {
-        *phys = new_location;
+        *phys = placement_address;
     }
     
-    uint32_t old_location = heap_place;
-    heap_place = new_location + size;
+    uint32_t addr = placement_address;
+    placement_address += size;
+    return (void*)addr;
+}
+
+static heap_header_t* block_of(void* p)
+{
+    return (heap_header_t*)((uint32_t)p - sizeof(heap_header_t));
+}
+
+static uint32_t track_bucket(uint32_t size)
+{
+    uint32_t bucket = 0;
+    uint32_t limit = 32;
+    while (size > limit && bucket < HEAP_TRACK_BUCKETS - 1) {
+        limit <<= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Slot for a caller, claimed on first use; -1 if the table is full
+static int32_t track_slot(uint32_t caller)
+{
+    uint32_t slot = (caller >> 2) % HEAP_TRACK_SITES;
+    for (uint32_t probe = 0; probe < HEAP_TRACK_SITES; probe++) {
+        heap_site_t* site = &track_sites[slot];
+        if (site->caller == caller) return (int32_t)slot;
+        if (site->caller == 0) {
+            site->caller = caller;
+            track_summary.sites++;
+            return (int32_t)slot;
+        }
+        slot = (slot + 1) % HEAP_TRACK_SITES;
+    }
+    return -1;
+}
+
+static void track_alloc(void* p, void* caller)
+{
+    if (!p || !kheap || (uint32_t)p < kheap->start_address) return;
     
-    if (heap_place > heap_max) {
-        expand(heap_max + size);
+    int32_t slot = track_slot((uint32_t)caller);
+    if (slot < 0) {
+        track_summary.dropped++;
+        return;
     }
     
-    return (void*)new_location;
+    heap_header_t* header = block_of(p);
+    uint32_t bytes = header->size - HEAP_OVERHEAD;
+    header->site = (uint16_t)((track_generation << 8) | (slot + 1));
+    
+    heap_site_t* site = &track_sites[slot];
+    site->allocs++;
+    site->histogram[track_bucket(bytes)]++;
+    site->live_bytes += bytes;
+    if (site->live_bytes > site->peak_bytes) site->peak_bytes = site->live_bytes;
+    
+    track_summary.live_bytes += bytes;
+    if (track_summary.live_bytes > track_summary.peak_bytes) {
+        track_summary.peak_bytes = track_summary.live_bytes;
+    }
+}
+
+static void track_free(void* p)
+{
+    if (!p || (uint32_t)p < kheap->start_address) return;
+    
+    heap_header_t* header = block_of(p);
+    if (header->magic != HEAP_MAGIC || (header->site >> 8) != track_generation) return;
+    
+    heap_site_t* site = &track_sites[(header->site & 0xFF) - 1];
+    uint32_t bytes = header->size - HEAP_OVERHEAD;
+    site->frees++;
+    site->live_bytes -= bytes;
+    track_summary.live_bytes -= bytes;
+    header->site = 0;
+}
+
+void heap_track_enable(bool enable)
+{
+    track_enabled = enable;
+    track_summary.enabled = enable;
+}
+
+void heap_track_reset(void)
+{
+    memset(track_sites, 0, sizeof(track_sites));
+    memset(&track_summary, 0, sizeof(track_summary));
+    track_summary.enabled = track_enabled;
+    
+    // Never reuse generation 0, which marks untracked blocks
+    track_generation++;
+    if (track_generation == 0) track_generation = 1;
 }
 
-void* kmalloc(uint32_t size)
+bool heap_track_get_site(uint32_t index, heap_site_t* site)
 {
-    return kmalloc_int(size, 0, 0);
+    if (index >= HEAP_TRACK_SITES || track_sites[index].caller == 0) return false;
+    *site = track_sites[index];
+    return true;
 }
 
-void* kmalloc_a(uint32_t size)
+void heap_track_get_summary(heap_track_summary_t* summary)
 {
-    return kmalloc_int(size, 1, 0);
+    *summary = track_summary;
 }
 
-void* kmalloc_p(uint32_t size, uint32_t* phys)
+void* kmalloc(size_t size)
 {
-    return kmalloc_int(size, 0, phys);
+    uint32_t irq = irq_save();
+    void* p = kmalloc_int(size, 0, 0);
+    if (track_enabled) track_alloc(p, __builtin_return_address(0));
+    irq_restore(irq);
+    return p;
 }
 
-void* kmalloc_ap(uint32_t size, uint32_t* phys)
+void* kmalloc_a(size_t size)
 {
-    return kmalloc_int(size, 1, phys);
+    uint32_t irq = irq_save();
+    void* p = kmalloc_int(size, 1, 0);
+    if (track_enabled) track_alloc(p, __builtin_return_address(0));
+    irq_restore(irq);
+    return p;
+}
+
+void* kmalloc_p(size_t size, uint32_t* phys)
+{
+    uint32_t irq = irq_save();
+    void* p = kmalloc_int(size, 0, phys);
+    if (track_enabled) track_alloc(p, __builtin_return_address(0));
+    irq_restore(irq);
+    return p;
+}
+
+void* kmalloc_ap(size_t size, uint32_t* phys)
+{
+    uint32_t irq = irq_save();
+    void* p = kmalloc_int(size, 1, phys);
+    if (track_enabled) track_alloc(p, __builtin_return_address(0));
+    irq_restore(irq);
+    return p;
+}
+
+void* kmalloc_aligned(size_t size, uint32_t align)
+{
+    if (!kheap) return NULL;
+    uint32_t irq = irq_save();
+    void* p = heap_alloc_aligned(kheap, size, align);
+    if (track_enabled) track_alloc(p, __builtin_return_address(0));
+    irq_restore(irq);
+    return p;
 }
 
 void kfree(void* p)
 {
-    // Simplified - in a full implementation, we'd mark the block as free
-    // For now, we'll just leave it (memory leak for simplicity)
-    UNUSED(p);
+    // Blocks from the early placement allocator are never returned
+    if (!kheap || (uint32_t)p < kheap->start_address) return;
+    uint32_t irq = irq_save();
+    
+    // Even with tracking off: a block tracked before must leave the counts
+    track_free(p);
+    heap_free(kheap, p);
+    irq_restore(irq);
 }
 
+void* krealloc(void* p, size_t size)
+{
+    if (!kheap) return NULL;
+    uint32_t irq = irq_save();
+    
+    // Account a resize as a free of the old block and an allocation by this
+    // caller. heap_realloc rewrites the header, so the free is accounted even
+    // with tracking off, or the old block would stay live forever.
+    track_free(p);
+    void* moved = heap_realloc(kheap, p, size);
+    if (track_enabled) track_alloc(moved ? moved : (size ? p : NULL), __builtin_return_address(0));
+    irq_restore(irq);
+    return moved;
+}
@@ -4,9 +4,11 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "../multiboot.h"
 
 #define PAGE_SIZE 4096
 #define KHEAP_START 0xC0000000
+#define KHEAP_MAX_ADDRESS 0xCFFFF000
 #define KHEAP_INITIAL_SIZE 0x100000
 #define HEAP_INDEX_SIZE 0x20000
 #define HEAP_MAGIC 0x123890AB
@@ -15,6 +17,8 @@
 typedef struct {
     uint32_t magic;
     uint8_t is_hole;
+    uint8_t reserved;
+    uint16_t site;              // Allocation-tracking site, 0 = untracked
     uint32_t size;
 } heap_header_t;
 
@@ -23,36 +27,342 @@ typedef struct {
     heap_header_t* header;
 } heap_footer_t;
 
+// Array of pointers kept sorted by a caller-supplied less-than predicate
+typedef int (*lessthan_predicate_t)(void*, void*);
+
+typedef struct ordered_array {
+    void** array;
+    uint32_t size;
+    uint32_t max_size;
+    lessthan_predicate_t predicate;
+} ordered_array_t;
+
 typedef struct {
-    uint32_t start_address;
-    uint32_t end_address;
-    uint32_t max_address;
+    ordered_array_t index;      // Holes, sorted by size (smallest first)
+    uint32_t start_address;     // First block (after the index)
+    uint32_t end_address;       // Current end of the heap
+    uint32_t max_address;       // Heap may not expand beyond this
     uint8_t supervisor;
     uint8_t readonly;
-} page_t;
+} heap_t;
+
+typedef struct {
+    uint32_t heap_size;         // end_address - start_address
+    uint32_t used_bytes;        // Bytes in allocated blocks (incl. headers)
+    uint32_t free_bytes;        // Bytes in holes (incl. headers)
+    uint32_t hole_count;
+    uint32_t largest_hole;
+    uint32_t alloc_count;       // Live allocations
+} heap_stats_t;
+
+// Page table / directory entry flags
+#define PAGE_PRESENT        0x001
+#define PAGE_WRITE          0x002
+#define PAGE_USER           0x004
+#define PAGE_WRITETHROUGH   0x008
+#define PAGE_NOCACHE        0x010
+#define PAGE_ACCESSED       0x020
+#define PAGE_DIRTY          0x040
+#define PAGE_LARGE          0x080   // Directory entry maps 4 MiB directly (PSE)
+#define PAGE_GLOBAL         0x100
+#define PAGE_FRAME_MASK     0xFFFFF000
+
+// Cache attributes: PWT alone selects PAT entry 1, which pat_init makes WC
+#define PAGE_CACHE_WB       0
+#define PAGE_CACHE_UC       (PAGE_NOCACHE | PAGE_WRITETHROUGH)
+#define PAGE_CACHE_MASK     (PAGE_NOCACHE | PAGE_WRITETHROUGH)
+
+#define LARGE_PAGE_SIZE 0x400000
+
+// Kernel virtual window for device memory (framebuffers, APIC, HPET)
+#define MMIO_START 0xD0000000
+#define MMIO_END 0xF0000000
+
+// Physical memory is identity mapped up to here; RAM above it is left unused
+#define LOWMEM_LIMIT KHEAP_START
+
+typedef uint32_t page_t;
+
+typedef struct {
+    page_t pages[1024];
+} page_table_t;
 
 typedef struct {
-    uint32_t total_frames;
-    uint32_t* frames;
-    page_t* pages;
+    uint32_t tables[1024];      // Physical address of each page table | flags
 } page_directory_t;
 
-void memory_init(uint32_t mem_size);
+typedef struct {
+    uint32_t identity_bytes;    // Low memory mapped 1:1
+    uint32_t large_pages;       // 4 MiB directory entries in the identity map
+    uint32_t page_tables;       // Frames holding the page directory and tables
+    uint32_t mapped_pages;      // 4 KiB pages mapped outside the identity map
+    bool pse;
+    bool pge;                   // Kernel mappings are global and survive CR3 reloads
+} paging_info_t;
+
+typedef struct {
+    uint32_t pages;             // Heap pages touched per round
+    uint32_t global_cycles;     // TSC cycles per round with global mappings
+    uint32_t local_cycles;      // ... with the global bit cleared
+} tlb_bench_t;
+
+typedef struct {
+    uint32_t minor_faults;      // Heap pages populated on first touch
+    uint64_t total_cycles;      // TSC cycles spent resolving them
+    uint32_t max_cycles;
+    uint32_t last_address;      // Most recent faulting address
+} page_fault_stats_t;
+
+void memory_init(multiboot_info_t* mbi);
 void* kmalloc(size_t size);
+void* kmalloc_a(size_t size);
+// phys is only meaningful for the first page; device buffers use dma_alloc
+void* kmalloc_p(size_t size, uint32_t* phys);
+void* kmalloc_ap(size_t size, uint32_t* phys);
+void* kmalloc_aligned(size_t size, uint32_t align);
 void kfree(void* ptr);
 void* krealloc(void* ptr, size_t size);
 uint32_t get_total_memory(void);
 uint32_t get_free_memory(void);
 
-// Page management
-page_directory_t* paging_get_directory(void);
-void paging_init(void);
-void paging_map_page(void* virtual_address, void* physical_address);
+// Heap management
+heap_t* create_heap(uint32_t start, uint32_t end, uint32_t max, uint8_t supervisor, uint8_t readonly);
+void* heap_alloc(heap_t* heap, uint32_t size, uint8_t page_align);
+void* heap_alloc_aligned(heap_t* heap, uint32_t size, uint32_t align);
+void heap_free(heap_t* heap, void* p);
+void* heap_realloc(heap_t* heap, void* p, uint32_t size);
+void heap_get_stats(heap_stats_t* stats);
+void heap_init(void);
+bool heap_populate_page(uint32_t addr);
+uint32_t heap_trim(void);
 
-#endif
+// Per-callsite allocation tracking
+#define HEAP_TRACK_SITES 128
+#define HEAP_TRACK_BUCKETS 8
 
+typedef struct {
+    uint32_t caller;            // Return address of the kmalloc call
+    uint32_t live_bytes;
+    uint32_t peak_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t histogram[HEAP_TRACK_BUCKETS];     // Sizes up to 32, 128, 512 ... bytes, last is open-ended
+} heap_site_t;
+
+typedef struct {
+    bool enabled;
+    uint32_t live_bytes;        // All tracked sites together
+    uint32_t peak_bytes;
+    uint32_t sites;
+    uint32_t dropped;           // Allocations not tracked because the site table was full
+} heap_track_summary_t;
+
+void heap_track_enable(bool enable);
+void heap_track_reset(void);
+bool heap_track_get_site(uint32_t index, heap_site_t* site);
+void heap_track_get_summary(heap_track_summary_t* summary);
 
+// Physical frame allocator
+void frame_init(multiboot_info_t* mbi);
+uint32_t frame_alloc(void);
+void frame_free(uint32_t phys);
+bool frame_claim_range(uint32_t start, uint32_t end);
+void frame_release_range(uint32_t start, uint32_t end);
+uint32_t frame_claim_aligned(uint32_t count, uint32_t limit);
+uint32_t frame_count_aligned(uint32_t count);
+uint32_t frame_get_free_count(void);
+uint32_t frame_get_usable_count(void);
+uint32_t frame_get_limit(void);
+
+// Buddy allocator for physically contiguous runs of 2^order frames
+#define BUDDY_MAX_ORDER 10
+
+typedef struct {
+    uint32_t free_blocks[BUDDY_MAX_ORDER + 1];      // Free blocks on each buddy list
+    uint32_t available_blocks[BUDDY_MAX_ORDER + 1]; // Blocks of each order that could be allocated
+    uint32_t free_pages;                            // Pages held on the buddy lists
+} buddy_info_t;
 
+void buddy_init(void);
+uint32_t alloc_pages(uint32_t order);
+void free_pages(uint32_t phys, uint32_t order);
+uint32_t buddy_get_free_pages(void);
+void buddy_get_info(buddy_info_t* info);
+bool buddy_owns(uint32_t phys);
 
+// Virtual memory areas: the mapped regions of an address space
+#define VMA_READ 0x01
+#define VMA_WRITE 0x02
+#define VMA_USER 0x04
+#define VMA_DEMAND 0x08                 // Pages are backed on first touch
+#define VMA_MMIO 0x10
+#define VMA_FIXED 0x20                  // Set up at boot, never unmapped
+#define VMA_NAME_LEN 16
 
+typedef struct vma vma_t;
+typedef bool (*vma_fault_fn_t)(vma_t* vma, uint32_t addr);
 
+struct vma {
+    uint32_t start;             // First byte, page aligned
+    uint32_t end;               // One past the last byte
+    uint32_t flags;
+    uint32_t resident_pages;    // Pages populated by the fault handler
+    vma_fault_fn_t fault;       // Backs a not-present page, NULL if none
+    char name[VMA_NAME_LEN];
+    vma_t* left;                // Red-black tree links, ordered by start
+    vma_t* right;
+    vma_t* parent;
+    bool red;
+};
+
+typedef struct {
+    char name[VMA_NAME_LEN];
+    page_directory_t* dir;
+    vma_t* root;
+    uint32_t vma_count;
+    uint32_t mapped_bytes;
+} address_space_t;
+
+void vma_init(void);
+address_space_t* vma_current_space(void);
+bool vma_insert(address_space_t* as, vma_t* vma);
+void vma_remove(address_space_t* as, vma_t* vma);
+vma_t* vma_find(address_space_t* as, uint32_t addr);
+vma_t* vma_first(address_space_t* as);
+vma_t* vma_next(vma_t* vma);
+bool vma_handle_fault(uint32_t addr, bool write);
+vma_t* as_map(address_space_t* as, uint32_t start, uint32_t size, uint32_t flags, const char* name);
+bool as_unmap(address_space_t* as, vma_t* vma);
+void as_clear(address_space_t* as);
+void vma_heap_released(uint32_t pages);
+
+// Physically contiguous, zeroed buffers for bus-master DMA
+#define DMA_ZONE_ISA 0x01               // Below 16 MiB, for ISA DMA and 24-bit devices
+#define DMA_ISA_LIMIT 0x1000000
+
+typedef struct {
+    uint32_t allocations;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t pages_in_use;
+    uint32_t isa_pages_in_use;  // ... of which below DMA_ISA_LIMIT
+    uint32_t peak_pages;
+} dma_stats_t;
+
+void* dma_alloc(size_t size, uint32_t align, uint32_t flags, uint32_t* phys);
+void dma_free(void* buf, size_t size, uint32_t align);
+void dma_get_stats(dma_stats_t* stats);
+
+// Pool of pre-zeroed frames, refilled from the idle loop
+#define ZERO_POOL_SIZE 64
+
+typedef struct {
+    uint32_t depth;             // Zeroed frames ready to hand out
+    uint32_t capacity;
+    uint32_t hits;              // Requests served from the pool
+    uint32_t misses;            // Requests that had to zero a frame inline
+    uint32_t idle_zeroed;       // Frames zeroed by the idle loop
+} zero_pool_stats_t;
+
+void clear_page(void* addr);
+uint32_t zero_page_alloc(void);
+bool zero_pool_refill(void);
+uint32_t zero_pool_get_depth(void);
+uint32_t zero_pool_drain(uint32_t pages);
+void zero_pool_get_stats(zero_pool_stats_t* stats);
+
+// Slab allocator: caches of fixed-size objects carved out of the heap
+#define KMEM_MIN_CLASS 16
+#define KMEM_MAX_CLASS 2048
+#define KMEM_NAME_LEN 24
+
+typedef struct kmem_slab kmem_slab_t;
+
+typedef struct kmem_cache {
+    char name[KMEM_NAME_LEN];
+    uint32_t object_size;       // Size requested by the creator
+    uint32_t stride;            // Object size rounded up to the alignment
+    uint32_t slab_size;         // Bytes per slab (power of two, slab is aligned to it)
+    uint32_t objects_per_slab;
+    kmem_slab_t* partial;       // Slabs with both used and free objects
+    kmem_slab_t* full;
+    kmem_slab_t* empty;
+    uint32_t slab_count;
+    uint32_t objects_in_use;
+    uint32_t total_allocs;
+    uint32_t total_frees;
+    struct kmem_cache* next;
+} kmem_cache_t;
+
+typedef struct {
+    uint32_t objects_in_use;
+    uint32_t objects_total;     // Capacity of all slabs
+    uint32_t slabs;
+    uint32_t bytes_total;       // Heap bytes held by the slabs
+    uint32_t bytes_wasted;      // Held bytes not backing a live object
+} kmem_cache_stats_t;
+
+void kmem_init(void);
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align);
+void* kmem_cache_alloc(kmem_cache_t* cache);
+void kmem_cache_free(kmem_cache_t* cache, void* obj);
+uint32_t kmem_cache_shrink(kmem_cache_t* cache);
+void kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* stats);
+kmem_cache_t* kmem_cache_first(void);
+void* kmem_alloc(size_t size);
+void kmem_free(void* obj);
+uint32_t kmem_size_class(size_t size);
+
+// Shrinkers: reclaim callbacks run under memory pressure
+typedef void (*shrink_fn_t)(uint32_t target_pages);
+
+typedef struct shrinker {
+    char name[KMEM_NAME_LEN];
+    shrink_fn_t shrink;         // Frees what it can toward target_pages
+    int32_t priority;           // Lower values run first
+    uint32_t calls;
+    uint32_t pages_reclaimed;   // Measured as the rise in free pages across each call
+    struct shrinker* next;
+} shrinker_t;
+
+typedef struct {
+    uint32_t low_watermark;     // Free pages below which pressure is flagged
+    uint32_t high_watermark;    // Free pages reclaim aims to get back to
+    uint32_t free_pages;
+    uint32_t pressure_events;
+    uint32_t reclaim_runs;
+    uint32_t pages_reclaimed;
+    bool pressure;              // Pressure flagged, reclaim not run yet
+} shrink_stats_t;
+
+void shrink_init(void);
+shrinker_t* shrinker_register(const char* name, shrink_fn_t shrink, int32_t priority);
+uint32_t shrink_memory(uint32_t target);
+void shrink_check(void);
+bool shrink_poll(void);
+void shrink_set_watermarks(uint32_t low, uint32_t high);
+void shrink_get_stats(shrink_stats_t* stats);
+shrinker_t* shrinker_first(void);
+
+// Page management
+page_directory_t* paging_get_directory(void);
+void paging_init(void);
+bool paging_map(uint32_t virtual_address, uint32_t physical_address, uint32_t flags);
+void paging_map_page(void* virtual_address, void* physical_address);
+uint32_t paging_unmap_page(void* virtual_address);
+uint32_t paging_get_physical(void* virtual_address);
+void paging_get_info(paging_info_t* info);
+void* paging_map_mmio(uint32_t physical_address, uint32_t size, uint32_t cache_flags);
+bool paging_set_cache(void* virtual_address, uint32_t size, uint32_t cache_flags);
+void paging_flush_tlb(void);
+void paging_flush_tlb_all(void);
+bool paging_tlb_benchmark(tlb_bench_t* result);
+void page_fault_handler(uint32_t err_code, uint32_t eip);
+
+// Memory types: PAT and MTRR programming
+void pat_init(void);
+uint32_t pat_write_combining(uint32_t phys, uint32_t size);
+const char* pat_wc_method(void);
+void paging_get_fault_stats(page_fault_stats_t* stats);
+
+#endif
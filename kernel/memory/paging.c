@@ -1,15 +1,122 @@
 #include "memory.h"
 #include "../lib/lib.h"
 #include "../kernel.h"
+#include "../cpu.h"
+#include "../smp.h"
+
+#define CR0_WP (1u << 16)
+#define CR0_PG (1u << 31)
+#define CR4_PSE (1u << 4)
+#define CR4_PGE (1u << 7)
+
+#define TLB_BENCH_PAGES 256
+#define TLB_BENCH_ROUNDS 64
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE 0x2
+#define PF_USER 0x4
+
+#define PDE_INDEX(addr) ((addr) >> 22)
+#define PTE_INDEX(addr) (((addr) >> 12) & 0x3FF)
 
 page_directory_t* current_directory = 0;
-uint32_t mem_size = 0x4000000; // 64MB default
+static page_directory_t* kernel_directory = 0;
+static paging_info_t paging_info;
+static page_fault_stats_t fault_stats;
+static uint32_t mmio_next = MMIO_START;
+
+static inline void invlpg(uint32_t addr)
+{
+    asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Page tables are reached through the identity map, so their physical
+// address doubles as a pointer
+static uint32_t alloc_table(void)
+{
+    uint32_t phys = zero_page_alloc();
+    if (!phys) {
+        kernel_panic("paging: out of memory for page tables");
+        return 0;
+    }
+    paging_info.page_tables++;
+    return phys;
+}
+
+// Entry for a 4 KiB page; NULL if it is covered by a large page or has no table
+static page_t* get_page(page_directory_t* dir, uint32_t virt, bool create, uint32_t flags)
+{
+    uint32_t pde = dir->tables[PDE_INDEX(virt)];
+    
+    if (!(pde & PAGE_PRESENT)) {
+        if (!create) return NULL;
+        pde = alloc_table() | PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
+        dir->tables[PDE_INDEX(virt)] = pde;
+    }
+    if (pde & PAGE_LARGE) return NULL;
+    
+    page_table_t* table = (page_table_t*)(pde & PAGE_FRAME_MASK);
+    return &table->pages[PTE_INDEX(virt)];
+}
+
+// Supervisor mappings are the same in every address space, so with PGE they
+// are marked global and stay in the TLB across CR3 reloads
+static uint32_t kernel_flags(uint32_t flags)
+{
+    if (paging_info.pge && !(flags & PAGE_USER)) {
+        flags |= PAGE_GLOBAL;
+    }
+    return flags;
+}
+
+// Map low memory 1:1 with 4 MiB pages, or 4 KiB tables on CPUs without PSE
+static void identity_map(page_directory_t* dir, uint32_t end)
+{
+    uint32_t flags = kernel_flags(PAGE_PRESENT | PAGE_WRITE);
+    
+    for (uint32_t addr = 0; addr < end; addr += LARGE_PAGE_SIZE) {
+        if (paging_info.pse) {
+            dir->tables[PDE_INDEX(addr)] = addr | flags | PAGE_LARGE;
+            paging_info.large_pages++;
+        } else {
+            uint32_t table = alloc_table();
+            page_table_t* pages = (page_table_t*)table;
+            for (uint32_t i = 0; i < 1024; i++) {
+                pages->pages[i] = (addr + i * PAGE_SIZE) | flags;
+            }
+            dir->tables[PDE_INDEX(addr)] = table | PAGE_PRESENT | PAGE_WRITE;
+        }
+    }
+    paging_info.identity_bytes = end;
+}
 
-void paging_init()
+void paging_init(void)
 {
-    // Simplified paging initialization
-    // In a full implementation, we'd set up page tables
-    current_directory = 0;
+    memset(&paging_info, 0, sizeof(paging_info));
+    paging_info.pse = cpu_has_feature_edx(CPUID_EDX_PSE);
+    paging_info.pge = cpu_has_feature_edx(CPUID_EDX_PGE);
+    pat_init();
+    
+    kernel_directory = (page_directory_t*)alloc_table();
+    
+    // Every frame the allocators can hand out has to stay reachable
+    uint32_t end = frame_get_limit() * PAGE_SIZE;
+    end = (end + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    if (end == 0 || end > LOWMEM_LIMIT) end = LOWMEM_LIMIT;
+    identity_map(kernel_directory, end);
+    
+    uint32_t cr0, cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (paging_info.pse) cr4 |= CR4_PSE;
+    if (paging_info.pge) cr4 |= CR4_PGE;
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+    asm volatile("mov %0, %%cr3" : : "r"(kernel_directory) : "memory");
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_PG | CR0_WP;
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+    
+    current_directory = kernel_directory;
 }
 
 page_directory_t* paging_get_directory()
@@ -17,27 +124,230 @@ page_directory_t* paging_get_directory()
     return current_directory;
 }
 
+// Map one 4 KiB page; fails if the address lies inside a large page
+bool paging_map(uint32_t virtual_address, uint32_t physical_address, uint32_t flags)
+{
+    page_t* page = get_page(current_directory, virtual_address, true, flags);
+    if (!page) return false;
+    
+    bool remap = (*page & PAGE_PRESENT) != 0;
+    if (!remap) {
+        paging_info.mapped_pages++;
+    }
+    *page = (physical_address & PAGE_FRAME_MASK) | kernel_flags(flags & ~PAGE_FRAME_MASK) | PAGE_PRESENT;
+    invlpg(virtual_address);
+    
+    // Other CPUs never cache a not-present entry, only a replaced one
+    if (remap) smp_tlb_shootdown();
+    return true;
+}
+
 void paging_map_page(void* virtual_address, void* physical_address)
 {
-    UNUSED(virtual_address);
-    UNUSED(physical_address);
-    // Simplified - full implementation would map pages
+    if (!paging_map((uint32_t)virtual_address, (uint32_t)physical_address, PAGE_WRITE)) {
+        kernel_panic("paging_map_page: address is covered by a large page");
+    }
 }
 
-void memory_init(uint32_t size)
+// Remove a 4 KiB mapping; returns the physical address it pointed to, or 0
+uint32_t paging_unmap_page(void* virtual_address)
 {
-    mem_size = size;
+    uint32_t virt = (uint32_t)virtual_address;
+    page_t* page = get_page(current_directory, virt, false, 0);
+    if (!page || !(*page & PAGE_PRESENT)) return 0;
+    
+    uint32_t phys = *page & PAGE_FRAME_MASK;
+    *page = 0;
+    invlpg(virt);
+    smp_tlb_shootdown();
+    paging_info.mapped_pages--;
+    return phys;
+}
+
+// Map device memory into the MMIO window; returns the virtual address of phys
+void* paging_map_mmio(uint32_t physical_address, uint32_t size, uint32_t cache_flags)
+{
+    uint32_t offset = physical_address & 0xFFF;
+    uint32_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages > (MMIO_END - mmio_next) / PAGE_SIZE) return NULL;
+    
+    uint32_t virt = mmio_next;
+    for (uint32_t i = 0; i < pages; i++) {
+        paging_map(virt + i * PAGE_SIZE, (physical_address & PAGE_FRAME_MASK) + i * PAGE_SIZE,
+                   PAGE_WRITE | (cache_flags & PAGE_CACHE_MASK));
+    }
+    mmio_next += pages * PAGE_SIZE;
+    
+    address_space_t* space = vma_current_space();
+    if (space) {
+        as_map(space, virt, pages * PAGE_SIZE, VMA_READ | VMA_WRITE | VMA_MMIO | VMA_FIXED, "mmio");
+    }
+    return (void*)(virt + offset);
+}
+
+// Change the memory type of already mapped 4 KiB pages
+bool paging_set_cache(void* virtual_address, uint32_t size, uint32_t cache_flags)
+{
+    uint32_t start = (uint32_t)virtual_address & PAGE_FRAME_MASK;
+    uint32_t end = (uint32_t)virtual_address + size;
+    
+    for (uint32_t virt = start; virt < end; virt += PAGE_SIZE) {
+        page_t* page = get_page(current_directory, virt, false, 0);
+        if (!page || !(*page & PAGE_PRESENT)) return false;
+        *page = (*page & ~PAGE_CACHE_MASK) | (cache_flags & PAGE_CACHE_MASK);
+        invlpg(virt);
+    }
+    smp_tlb_shootdown();
+    
+    // Drain write-combining buffers and lines cached under the old type
+    asm volatile("wbinvd" : : : "memory");
+    return true;
+}
+
+// Drop non-global translations, as an address-space switch does
+void paging_flush_tlb(void)
+{
+    uint32_t cr3;
+    asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+// Drop every translation, global ones included; on this CPU only, like
+// paging_flush_tlb
+void paging_flush_tlb_all(void)
+{
+    if (!paging_info.pge) {
+        paging_flush_tlb();
+        return;
+    }
+    
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+    asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+static void set_global(uint32_t start, uint32_t pages, bool global)
+{
+    for (uint32_t i = 0; i < pages; i++) {
+        page_t* page = get_page(current_directory, start + i * PAGE_SIZE, false, 0);
+        if (!page) continue;
+        *page = global ? (*page | PAGE_GLOBAL) : (*page & ~PAGE_GLOBAL);
+    }
+    paging_flush_tlb_all();
+    smp_tlb_shootdown();
+}
+
+// Cycles to touch every page of a buffer right after a CR3 reload
+static uint32_t time_tlb_rounds(volatile uint32_t* buffer)
+{
+    uint32_t sum = 0;
+    uint64_t start = rdtsc();
+    for (uint32_t round = 0; round < TLB_BENCH_ROUNDS; round++) {
+        paging_flush_tlb();
+        for (uint32_t i = 0; i < TLB_BENCH_PAGES; i++) {
+            sum += buffer[i * (PAGE_SIZE / 4)];
+        }
+    }
+    uint32_t cycles = (uint32_t)div_u64(rdtsc() - start, TLB_BENCH_ROUNDS);
+    (void)sum;
+    return cycles;
+}
+
+// Compare the cost of address-space switches with and without global kernel pages
+bool paging_tlb_benchmark(tlb_bench_t* result)
+{
+    if (!paging_info.pge) return false;
+    
+    volatile uint32_t* buffer = (volatile uint32_t*)kmalloc_a(TLB_BENCH_PAGES * PAGE_SIZE);
+    if (!buffer) return false;
+    
+    // Fault every page in before timing anything
+    for (uint32_t i = 0; i < TLB_BENCH_PAGES; i++) {
+        buffer[i * (PAGE_SIZE / 4)] = i;
+    }
+    
+    result->pages = TLB_BENCH_PAGES;
+    result->global_cycles = time_tlb_rounds(buffer);
+    set_global((uint32_t)buffer, TLB_BENCH_PAGES, false);
+    result->local_cycles = time_tlb_rounds(buffer);
+    set_global((uint32_t)buffer, TLB_BENCH_PAGES, true);
+    
+    kfree((void*)buffer);
+    return true;
+}
+
+// Translate a virtual address; returns 0 if it is not mapped
+uint32_t paging_get_physical(void* virtual_address)
+{
+    uint32_t virt = (uint32_t)virtual_address;
+    if (!current_directory) return virt;
+    
+    uint32_t pde = current_directory->tables[PDE_INDEX(virt)];
+    if (!(pde & PAGE_PRESENT)) return 0;
+    if (pde & PAGE_LARGE) {
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | (virt & (LARGE_PAGE_SIZE - 1));
+    }
+    
+    page_t page = ((page_table_t*)(pde & PAGE_FRAME_MASK))->pages[PTE_INDEX(virt)];
+    if (!(page & PAGE_PRESENT)) return 0;
+    return (page & PAGE_FRAME_MASK) | (virt & 0xFFF);
+}
+
+void paging_get_info(paging_info_t* info)
+{
+    *info = paging_info;
+}
+
+void page_fault_handler(uint32_t err_code, uint32_t eip)
+{
+    uint64_t start = rdtsc();
+    uint32_t addr;
+    asm volatile("mov %%cr2, %0" : "=r"(addr));
+    
+    // Demand paging: regions like the heap are only backed once touched
+    if (!(err_code & PF_PRESENT) && vma_handle_fault(addr, (err_code & PF_WRITE) != 0)) {
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        fault_stats.minor_faults++;
+        fault_stats.total_cycles += cycles;
+        if (cycles > fault_stats.max_cycles) {
+            fault_stats.max_cycles = cycles;
+        }
+        fault_stats.last_address = addr;
+        return;
+    }
+    
+    printf("\nPage fault at %x (eip %x): %s %s in %s mode\n", addr, eip,
+           (err_code & PF_WRITE) ? "write" : "read",
+           (err_code & PF_PRESENT) ? "protection violation" : "of unmapped page",
+           (err_code & PF_USER) ? "user" : "kernel");
+    kernel_panic("Unhandled page fault");
+}
+
+void paging_get_fault_stats(page_fault_stats_t* stats)
+{
+    *stats = fault_stats;
+}
+
+void memory_init(multiboot_info_t* mbi)
+{
+    frame_init(mbi);
+    
+    // Page tables come straight from the frame allocator, so paging can be
+    // turned on before the heap, which lives at KHEAP_START
     paging_init();
+    vma_init();
+    heap_init();
+    kmem_init();
+    buddy_init();
+    shrink_init();
 }
 
 uint32_t get_total_memory(void)
 {
-    return mem_size;
+    return frame_get_usable_count() * PAGE_SIZE;
 }
 
 uint32_t get_free_memory(void)
 {
-    // Simplified - return most of memory as free
-    return mem_size - 0x100000;
+    return (frame_get_free_count() + buddy_get_free_pages() + zero_pool_get_depth()) * PAGE_SIZE;
 }
-
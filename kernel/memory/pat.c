@@ -0,0 +1,132 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+#define MSR_MTRRCAP 0xFE
+#define MSR_MTRR_PHYSBASE(n) (0x200 + 2 * (n))
+#define MSR_MTRR_PHYSMASK(n) (0x201 + 2 * (n))
+#define MSR_MTRR_DEF_TYPE 0x2FF
+#define MSR_PAT 0x277
+
+#define MTRRCAP_VCNT_MASK 0xFF
+#define MTRRCAP_WC (1u << 10)
+#define MTRR_VALID (1u << 11)
+#define MTRR_ENABLE (1u << 11)
+
+#define MEMTYPE_WC 0x01
+
+#define CR0_NW (1u << 29)
+#define CR0_CD (1u << 30)
+
+enum {
+    WC_NONE,
+    WC_PAT,
+    WC_MTRR
+};
+
+static int wc_method = WC_NONE;
+static bool pat_enabled = false;
+
+static inline void wbinvd(void)
+{
+    asm volatile("wbinvd" : : : "memory");
+}
+
+// Physical address width, which bounds the MTRR mask
+static uint32_t phys_address_bits(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000008) return 36;
+    cpuid(0x80000008, &eax, &ebx, &ecx, &edx);
+    return eax & 0xFF;
+}
+
+// Reprogram PAT entry 1 (selected by PWT alone) from write-through to
+// write-combining; entries 0, 2 and 3 keep WB, UC- and UC
+void pat_init(void)
+{
+    if (!cpu_has_feature_edx(CPUID_EDX_MSR | CPUID_EDX_PAT)) return;
+    
+    uint64_t pat = rdmsr(MSR_PAT);
+    pat &= ~(0xFFull << 8);
+    pat |= (uint64_t)MEMTYPE_WC << 8;
+    
+    wbinvd();
+    wrmsr(MSR_PAT, pat);
+    wbinvd();
+    pat_enabled = true;
+}
+
+// Cover [phys, phys + size) with a write-combining variable MTRR
+static bool mtrr_set_wc(uint32_t phys, uint32_t size)
+{
+    if (!cpu_has_feature_edx(CPUID_EDX_MSR | CPUID_EDX_MTRR)) return false;
+    
+    uint64_t cap = rdmsr(MSR_MTRRCAP);
+    if (!(cap & MTRRCAP_WC)) return false;
+    
+    // Variable ranges are power-of-two sized and aligned to their size
+    uint32_t range = PAGE_SIZE;
+    while (range < size && range < 0x80000000) range <<= 1;
+    if (range < size || (phys & (range - 1))) return false;
+    
+    uint32_t count = cap & MTRRCAP_VCNT_MASK;
+    uint32_t slot;
+    for (slot = 0; slot < count; slot++) {
+        if (!(rdmsr(MSR_MTRR_PHYSMASK(slot)) & MTRR_VALID)) break;
+    }
+    if (slot == count) return false;
+    
+    uint64_t addr_mask = (1ull << phys_address_bits()) - 1;
+    uint64_t mask = (addr_mask & ~(uint64_t)(range - 1)) | MTRR_VALID;
+    
+    // Intel SDM 11.11.7.2: caches off and flushed while the MTRRs change
+    uint32_t flags = irq_save();
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"((cr0 | CR0_CD) & ~CR0_NW) : "memory");
+    wbinvd();
+    
+    uint64_t def_type = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type & ~(uint64_t)MTRR_ENABLE);
+    wrmsr(MSR_MTRR_PHYSBASE(slot), (uint64_t)phys | MEMTYPE_WC);
+    wrmsr(MSR_MTRR_PHYSMASK(slot), mask);
+    wrmsr(MSR_MTRR_DEF_TYPE, def_type);
+    
+    wbinvd();
+    paging_flush_tlb_all();
+    asm volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+    irq_restore(flags);
+    return true;
+}
+
+// Page flags that make a mapping of [phys, phys + size) write-combining.
+// Falls back to a WC MTRR (with a normal WB mapping) without PAT, and to
+// uncached if neither is available.
+uint32_t pat_write_combining(uint32_t phys, uint32_t size)
+{
+    if (pat_enabled) {
+        wc_method = WC_PAT;
+        return PAGE_WRITETHROUGH;
+    }
+    if (mtrr_set_wc(phys, size)) {
+        wc_method = WC_MTRR;
+        return 0;
+    }
+    wc_method = WC_NONE;
+    return PAGE_CACHE_UC;
+}
+
+const char* pat_wc_method(void)
+{
+    switch (wc_method) {
+        case WC_PAT:
+            return "PAT";
+        case WC_MTRR:
+            return "MTRR";
+        default:
+            return "none (uncached)";
+    }
+}
@@ -0,0 +1,146 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Subsystems holding reclaimable memory register a shrinker here. When free
+// memory drops below the low watermark the frame allocator flags pressure,
+// and the shrinkers run (lowest priority value first) from the idle loop or
+// a failing kmalloc until free memory is back above the high watermark.
+
+static shrinker_t* shrinker_list = NULL;
+static shrink_stats_t shrink_stats;
+static bool pressure_pending = false;
+static bool reclaim_running = false;
+
+// Frames frame_alloc can still hand out; pages parked in the zero pool are
+// not counted, so draining the pool shows up as reclaimed memory
+static uint32_t free_pages_now(void)
+{
+    return frame_get_free_count() + buddy_get_free_pages();
+}
+
+shrinker_t* shrinker_register(const char* name, shrink_fn_t shrink, int32_t priority)
+{
+    shrinker_t* shrinker = (shrinker_t*)kmalloc(sizeof(shrinker_t));
+    if (!shrinker) return NULL;
+    memset(shrinker, 0, sizeof(shrinker_t));
+    
+    strncpy(shrinker->name, name, KMEM_NAME_LEN - 1);
+    shrinker->shrink = shrink;
+    shrinker->priority = priority;
+    
+    // Keep the list sorted by priority, later registrations after equal ones
+    shrinker_t** link = &shrinker_list;
+    while (*link && (*link)->priority <= priority) {
+        link = &(*link)->next;
+    }
+    shrinker->next = *link;
+    *link = shrinker;
+    return shrinker;
+}
+
+// Run shrinkers until target pages have been freed; returns pages reclaimed
+uint32_t shrink_memory(uint32_t target)
+{
+    // Idle threads on several CPUs may get here at once
+    uint32_t irq = irq_save();
+    bool busy = reclaim_running;
+    reclaim_running = true;
+    irq_restore(irq);
+    if (busy) return 0;
+    shrink_stats.reclaim_runs++;
+    
+    uint32_t reclaimed = 0;
+    for (shrinker_t* shrinker = shrinker_list; shrinker && reclaimed < target; shrinker = shrinker->next) {
+        uint32_t before = free_pages_now();
+        shrinker->shrink(target - reclaimed);
+        uint32_t after = free_pages_now();
+        
+        shrinker->calls++;
+        if (after > before) {
+            shrinker->pages_reclaimed += after - before;
+            reclaimed += after - before;
+        }
+    }
+    
+    shrink_stats.pages_reclaimed += reclaimed;
+    reclaim_running = false;
+    return reclaimed;
+}
+
+// Called by the frame allocator; only flags pressure, since it may run in
+// the middle of a heap operation or a page fault
+void shrink_check(void)
+{
+    if (pressure_pending || shrink_stats.low_watermark == 0) return;
+    if (free_pages_now() < shrink_stats.low_watermark) {
+        pressure_pending = true;
+        shrink_stats.pressure_events++;
+    }
+}
+
+// Reclaim from a safe context if pressure was flagged; returns true if it did work
+bool shrink_poll(void)
+{
+    if (!pressure_pending || reclaim_running) return false;
+    
+    uint32_t free = free_pages_now();
+    if (free < shrink_stats.high_watermark) {
+        shrink_memory(shrink_stats.high_watermark - free);
+    }
+    pressure_pending = false;
+    return true;
+}
+
+void shrink_set_watermarks(uint32_t low, uint32_t high)
+{
+    if (high < low) high = low;
+    shrink_stats.low_watermark = low;
+    shrink_stats.high_watermark = high;
+}
+
+void shrink_get_stats(shrink_stats_t* stats)
+{
+    *stats = shrink_stats;
+    stats->free_pages = free_pages_now();
+    stats->pressure = pressure_pending;
+}
+
+shrinker_t* shrinker_first(void)
+{
+    return shrinker_list;
+}
+
+static void shrink_zero_pool(uint32_t target)
+{
+    zero_pool_drain(target);
+}
+
+static void shrink_slab_caches(uint32_t target)
+{
+    UNUSED(target);
+    for (kmem_cache_t* cache = kmem_cache_first(); cache; cache = cache->next) {
+        kmem_cache_shrink(cache);
+    }
+}
+
+static void shrink_heap(uint32_t target)
+{
+    UNUSED(target);
+    heap_trim();
+}
+
+void shrink_init(void)
+{
+    // Default: start reclaiming below 1/64 of memory (at least 1 MiB)
+    uint32_t low = frame_get_usable_count() / 64;
+    if (low < 256) low = 256;
+    shrink_set_watermarks(low, low * 2);
+    
+    shrinker_register("zeropool", shrink_zero_pool, 0);
+    shrinker_register("slab", shrink_slab_caches, 10);
+    
+    // Last, so it picks up the holes the other shrinkers leave behind
+    shrinker_register("heap", shrink_heap, 100);
+}
@@ -0,0 +1,265 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+#define SLAB_MAGIC 0x51AB51AB
+#define SLAB_MAX_SIZE (8 * PAGE_SIZE)
+#define SLAB_MIN_OBJECTS 8
+#define KMEM_NUM_CLASSES 8   // 16, 32, ... 2048
+#define KMEM_CLASS_SLAB_SIZE (4 * PAGE_SIZE)
+
+// Slab header, stored at the start of every slab
+struct kmem_slab {
+    uint32_t magic;
+    kmem_cache_t* cache;
+    kmem_slab_t* next;
+    kmem_slab_t* prev;
+    void* free_list;            // Free objects, linked through their first word
+    uint32_t in_use;
+};
+
+#define SLAB_HEADER_SIZE ((sizeof(kmem_slab_t) + 15) & ~15u)
+
+static kmem_cache_t* cache_list = NULL;
+static kmem_cache_t* size_caches[KMEM_NUM_CLASSES];
+static const char* size_cache_names[KMEM_NUM_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"
+};
+
+static void slab_list_add(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(kmem_slab_t** list, kmem_slab_t* slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = NULL;
+    slab->prev = NULL;
+}
+
+static kmem_slab_t* slab_create(kmem_cache_t* cache)
+{
+    // Slabs are aligned to their size so an object's slab is found by masking
+    kmem_slab_t* slab = (kmem_slab_t*)kmalloc_aligned(cache->slab_size, cache->slab_size);
+    if (!slab) return NULL;
+    
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    
+    // Thread the free list so objects are handed out in address order
+    uint32_t base = (uint32_t)slab + SLAB_HEADER_SIZE;
+    for (uint32_t i = cache->objects_per_slab; i > 0; i--) {
+        void** obj = (void**)(base + (i - 1) * cache->stride);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+    
+    cache->slab_count++;
+    return slab;
+}
+
+static void slab_destroy(kmem_cache_t* cache, kmem_slab_t* slab)
+{
+    slab->magic = 0;
+    cache->slab_count--;
+    kfree(slab);
+}
+
+static kmem_cache_t* cache_create(const char* name, uint32_t size, uint32_t stride, uint32_t slab_size)
+{
+    kmem_cache_t* cache = (kmem_cache_t*)kmalloc(sizeof(kmem_cache_t));
+    if (!cache) return NULL;
+    memset(cache, 0, sizeof(kmem_cache_t));
+    
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    cache->object_size = size;
+    cache->stride = stride;
+    cache->slab_size = slab_size;
+    cache->objects_per_slab = (slab_size - SLAB_HEADER_SIZE) / stride;
+    
+    cache->next = cache_list;
+    cache_list = cache;
+    return cache;
+}
+
+kmem_cache_t* kmem_cache_create(const char* name, size_t size, size_t align)
+{
+    if (size == 0) return NULL;
+    if (align < sizeof(void*)) align = sizeof(void*);
+    if (size < sizeof(void*)) size = sizeof(void*);
+    
+    uint32_t stride = (size + align - 1) & ~(align - 1);
+    if (stride + SLAB_HEADER_SIZE > SLAB_MAX_SIZE) return NULL;
+    
+    // Grow the slab until it holds enough objects to keep waste low
+    uint32_t slab_size = PAGE_SIZE;
+    while (slab_size < SLAB_MAX_SIZE && (slab_size - SLAB_HEADER_SIZE) / stride < SLAB_MIN_OBJECTS) {
+        slab_size *= 2;
+    }
+    return cache_create(name, size, stride, slab_size);
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+    uint32_t irq = irq_save();
+    kmem_slab_t* slab = cache->partial;
+    
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+        } else {
+            slab = slab_create(cache);
+            if (!slab) {
+                irq_restore(irq);
+                return NULL;
+            }
+        }
+        slab_list_add(&cache->partial, slab);
+    }
+    
+    void** obj = (void**)slab->free_list;
+    slab->free_list = *obj;
+    slab->in_use++;
+    
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_add(&cache->full, slab);
+    }
+    
+    cache->objects_in_use++;
+    cache->total_allocs++;
+    irq_restore(irq);
+    return obj;
+}
+
+static kmem_slab_t* slab_of(void* obj, uint32_t slab_size)
+{
+    return (kmem_slab_t*)((uint32_t)obj & ~(slab_size - 1));
+}
+
+void kmem_cache_free(kmem_cache_t* cache, void* obj)
+{
+    if (!obj) return;
+    
+    kmem_slab_t* slab = slab_of(obj, cache->slab_size);
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache) {
+        kernel_panic("kmem_cache_free: object does not belong to cache");
+        return;
+    }
+    
+    uint32_t irq = irq_save();
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_add(&cache->partial, slab);
+    }
+    
+    *(void**)obj = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->objects_in_use--;
+    cache->total_frees++;
+    
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        // Keep one empty slab around to absorb alloc/free ping-pong
+        if (cache->empty) {
+            slab_destroy(cache, slab);
+        } else {
+            slab_list_add(&cache->empty, slab);
+        }
+    }
+    irq_restore(irq);
+}
+
+// Release all empty slabs back to the heap; returns bytes released
+uint32_t kmem_cache_shrink(kmem_cache_t* cache)
+{
+    uint32_t irq = irq_save();
+    uint32_t released = 0;
+    
+    while (cache->empty) {
+        kmem_slab_t* slab = cache->empty;
+        slab_list_remove(&cache->empty, slab);
+        slab_destroy(cache, slab);
+        released += cache->slab_size;
+    }
+    irq_restore(irq);
+    return released;
+}
+
+void kmem_cache_get_stats(kmem_cache_t* cache, kmem_cache_stats_t* stats)
+{
+    stats->objects_in_use = cache->objects_in_use;
+    stats->objects_total = cache->slab_count * cache->objects_per_slab;
+    stats->slabs = cache->slab_count;
+    stats->bytes_total = cache->slab_count * cache->slab_size;
+    stats->bytes_wasted = stats->bytes_total - cache->objects_in_use * cache->object_size;
+}
+
+kmem_cache_t* kmem_cache_first(void)
+{
+    return cache_list;
+}
+
+static int32_t size_class_index(size_t size)
+{
+    if (size > KMEM_MAX_CLASS) return -1;
+    
+    int32_t index = 0;
+    uint32_t class_size = KMEM_MIN_CLASS;
+    while (class_size < size) {
+        class_size <<= 1;
+        index++;
+    }
+    return index;
+}
+
+// Size of the object kmem_alloc hands out for a request, or 0 if too large
+uint32_t kmem_size_class(size_t size)
+{
+    int32_t index = size_class_index(size);
+    if (index < 0) return 0;
+    return KMEM_MIN_CLASS << index;
+}
+
+void* kmem_alloc(size_t size)
+{
+    int32_t index = size_class_index(size);
+    if (index < 0 || !size_caches[index]) return NULL;
+    return kmem_cache_alloc(size_caches[index]);
+}
+
+void kmem_free(void* obj)
+{
+    if (!obj) return;
+    
+    // All size-class slabs share one size, so masking finds the slab directly
+    kmem_slab_t* slab = slab_of(obj, KMEM_CLASS_SLAB_SIZE);
+    if (slab->magic != SLAB_MAGIC) {
+        kernel_panic("kmem_free: pointer is not a slab object");
+        return;
+    }
+    kmem_cache_free(slab->cache, obj);
+}
+
+void kmem_init(void)
+{
+    for (int i = 0; i < KMEM_NUM_CLASSES; i++) {
+        uint32_t size = KMEM_MIN_CLASS << i;
+        size_caches[i] = cache_create(size_cache_names[i], size, size, KMEM_CLASS_SLAB_SIZE);
+    }
+}
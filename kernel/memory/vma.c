@@ -0,0 +1,417 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Each address space keeps its mapped regions in a red-black tree ordered by
+// start address. Regions never overlap, so a lookup is a single descent.
+// Nodes are embedded in the vma_t; regions set up before the slab allocator
+// exists are static, later ones come from the "vma" cache.
+
+static address_space_t kernel_space;
+static address_space_t* current_space = NULL;
+static vma_t lowmem_vma;
+static vma_t heap_vma;
+static kmem_cache_t* vma_cache = NULL;
+
+static void rotate_left(address_space_t* as, vma_t* x)
+{
+    vma_t* y = x->right;
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+    y->parent = x->parent;
+    if (!x->parent) {
+        as->root = y;
+    } else if (x == x->parent->left) {
+        x->parent->left = y;
+    } else {
+        x->parent->right = y;
+    }
+    y->left = x;
+    x->parent = y;
+}
+
+static void rotate_right(address_space_t* as, vma_t* x)
+{
+    vma_t* y = x->left;
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+    y->parent = x->parent;
+    if (!x->parent) {
+        as->root = y;
+    } else if (x == x->parent->right) {
+        x->parent->right = y;
+    } else {
+        x->parent->left = y;
+    }
+    y->right = x;
+    x->parent = y;
+}
+
+static bool is_red(vma_t* vma)
+{
+    return vma && vma->red;
+}
+
+static void insert_fixup(address_space_t* as, vma_t* z)
+{
+    while (is_red(z->parent)) {
+        vma_t* p = z->parent;
+        vma_t* g = p->parent;
+        
+        if (p == g->left) {
+            vma_t* u = g->right;
+            if (is_red(u)) {
+                p->red = false;
+                u->red = false;
+                g->red = true;
+                z = g;
+                continue;
+            }
+            if (z == p->right) {
+                rotate_left(as, p);
+                z = p;
+                p = z->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rotate_right(as, g);
+        } else {
+            vma_t* u = g->left;
+            if (is_red(u)) {
+                p->red = false;
+                u->red = false;
+                g->red = true;
+                z = g;
+                continue;
+            }
+            if (z == p->left) {
+                rotate_right(as, p);
+                z = p;
+                p = z->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rotate_left(as, g);
+        }
+    }
+    as->root->red = false;
+}
+
+static void transplant(address_space_t* as, vma_t* u, vma_t* v)
+{
+    if (!u->parent) {
+        as->root = v;
+    } else if (u == u->parent->left) {
+        u->parent->left = v;
+    } else {
+        u->parent->right = v;
+    }
+    if (v) v->parent = u->parent;
+}
+
+// x may be NULL, so its parent is tracked separately
+static void remove_fixup(address_space_t* as, vma_t* x, vma_t* parent)
+{
+    while (x != as->root && !is_red(x)) {
+        if (x == parent->left) {
+            vma_t* w = parent->right;
+            if (is_red(w)) {
+                w->red = false;
+                parent->red = true;
+                rotate_left(as, parent);
+                w = parent->right;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+            } else {
+                if (!is_red(w->right)) {
+                    w->left->red = false;
+                    w->red = true;
+                    rotate_right(as, w);
+                    w = parent->right;
+                }
+                w->red = parent->red;
+                parent->red = false;
+                w->right->red = false;
+                rotate_left(as, parent);
+                x = as->root;
+            }
+        } else {
+            vma_t* w = parent->left;
+            if (is_red(w)) {
+                w->red = false;
+                parent->red = true;
+                rotate_right(as, parent);
+                w = parent->left;
+            }
+            if (!is_red(w->left) && !is_red(w->right)) {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+            } else {
+                if (!is_red(w->left)) {
+                    w->right->red = false;
+                    w->red = true;
+                    rotate_left(as, w);
+                    w = parent->left;
+                }
+                w->red = parent->red;
+                parent->red = false;
+                w->left->red = false;
+                rotate_right(as, parent);
+                x = as->root;
+            }
+        }
+    }
+    if (x) x->red = false;
+}
+
+// Link a region into the tree; fails if it overlaps an existing one
+bool vma_insert(address_space_t* as, vma_t* vma)
+{
+    if (vma->start >= vma->end) return false;
+    
+    uint32_t irq = irq_save();
+    vma_t* parent = NULL;
+    vma_t** link = &as->root;
+    while (*link) {
+        parent = *link;
+        if (vma->end <= parent->start) {
+            link = &parent->left;
+        } else if (vma->start >= parent->end) {
+            link = &parent->right;
+        } else {
+            irq_restore(irq);
+            return false;
+        }
+    }
+    
+    vma->parent = parent;
+    vma->left = NULL;
+    vma->right = NULL;
+    vma->red = true;
+    *link = vma;
+    insert_fixup(as, vma);
+    
+    as->vma_count++;
+    as->mapped_bytes += vma->end - vma->start;
+    irq_restore(irq);
+    return true;
+}
+
+void vma_remove(address_space_t* as, vma_t* vma)
+{
+    uint32_t irq = irq_save();
+    vma_t* x;
+    vma_t* x_parent;
+    bool removed_red = vma->red;
+    
+    if (!vma->left) {
+        x = vma->right;
+        x_parent = vma->parent;
+        transplant(as, vma, vma->right);
+    } else if (!vma->right) {
+        x = vma->left;
+        x_parent = vma->parent;
+        transplant(as, vma, vma->left);
+    } else {
+        // Two children: the successor takes this node's place
+        vma_t* next = vma->right;
+        while (next->left) next = next->left;
+        removed_red = next->red;
+        x = next->right;
+        
+        if (next->parent == vma) {
+            x_parent = next;
+        } else {
+            x_parent = next->parent;
+            transplant(as, next, next->right);
+            next->right = vma->right;
+            next->right->parent = next;
+        }
+        transplant(as, vma, next);
+        next->left = vma->left;
+        next->left->parent = next;
+        next->red = vma->red;
+    }
+    
+    if (!removed_red) {
+        remove_fixup(as, x, x_parent);
+    }
+    
+    vma->left = vma->right = vma->parent = NULL;
+    as->vma_count--;
+    as->mapped_bytes -= vma->end - vma->start;
+    irq_restore(irq);
+}
+
+// Region containing addr, or NULL
+vma_t* vma_find(address_space_t* as, uint32_t addr)
+{
+    vma_t* node = as ? as->root : NULL;
+    while (node) {
+        if (addr < node->start) {
+            node = node->left;
+        } else if (addr >= node->end) {
+            node = node->right;
+        } else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+// In-order iteration: lowest region first
+vma_t* vma_first(address_space_t* as)
+{
+    vma_t* node = as->root;
+    while (node && node->left) node = node->left;
+    return node;
+}
+
+vma_t* vma_next(vma_t* vma)
+{
+    if (vma->right) {
+        vma = vma->right;
+        while (vma->left) vma = vma->left;
+        return vma;
+    }
+    while (vma->parent && vma == vma->parent->right) {
+        vma = vma->parent;
+    }
+    return vma->parent;
+}
+
+static void vma_setup(vma_t* vma, uint32_t start, uint32_t end, uint32_t flags, const char* name,
+                      vma_fault_fn_t fault)
+{
+    memset(vma, 0, sizeof(vma_t));
+    vma->start = start;
+    vma->end = end;
+    vma->flags = flags;
+    vma->fault = fault;
+    strncpy(vma->name, name, VMA_NAME_LEN - 1);
+}
+
+static uint32_t vma_page_flags(vma_t* vma)
+{
+    uint32_t flags = PAGE_PRESENT;
+    if (vma->flags & VMA_WRITE) flags |= PAGE_WRITE;
+    if (vma->flags & VMA_USER) flags |= PAGE_USER;
+    return flags;
+}
+
+static bool heap_fault(vma_t* vma, uint32_t addr)
+{
+    if (!heap_populate_page(addr)) return false;
+    vma->resident_pages++;
+    return true;
+}
+
+// The heap unmaps pages it no longer needs itself, without a fault handler
+// call, so it reports them here to keep the heap region's count right
+void vma_heap_released(uint32_t pages)
+{
+    heap_vma.resident_pages -= pages;
+}
+
+// Anonymous regions are backed by a zeroed frame on first touch
+static bool anon_fault(vma_t* vma, uint32_t addr)
+{
+    uint32_t phys = zero_page_alloc();
+    if (!phys) return false;
+    
+    if (!paging_map(addr & PAGE_FRAME_MASK, phys, vma_page_flags(vma))) {
+        frame_free(phys);
+        return false;
+    }
+    vma->resident_pages++;
+    return true;
+}
+
+// Runs between paging_init and heap_init, so the heap's own faults resolve
+void vma_init(void)
+{
+    memset(&kernel_space, 0, sizeof(kernel_space));
+    kernel_space.dir = paging_get_directory();
+    strncpy(kernel_space.name, "kernel", VMA_NAME_LEN - 1);
+    
+    paging_info_t info;
+    paging_get_info(&info);
+    vma_setup(&lowmem_vma, 0, info.identity_bytes, VMA_READ | VMA_WRITE | VMA_FIXED, "lowmem", NULL);
+    vma_insert(&kernel_space, &lowmem_vma);
+    
+    vma_setup(&heap_vma, KHEAP_START, KHEAP_MAX_ADDRESS, VMA_READ | VMA_WRITE | VMA_DEMAND | VMA_FIXED,
+              "heap", heap_fault);
+    vma_insert(&kernel_space, &heap_vma);
+    
+    current_space = &kernel_space;
+}
+
+address_space_t* vma_current_space(void)
+{
+    return current_space;
+}
+
+// Record a region in the current address space; the pages themselves are
+// mapped by the caller, or on first touch for VMA_DEMAND
+vma_t* as_map(address_space_t* as, uint32_t start, uint32_t size, uint32_t flags, const char* name)
+{
+    if (!vma_cache) {
+        vma_cache = kmem_cache_create("vma", sizeof(vma_t), sizeof(uint32_t));
+        if (!vma_cache) return NULL;
+    }
+    
+    start &= PAGE_FRAME_MASK;
+    uint32_t end = (start + size + PAGE_SIZE - 1) & PAGE_FRAME_MASK;
+    if (end <= start) return NULL;
+    
+    vma_t* vma = (vma_t*)kmem_cache_alloc(vma_cache);
+    if (!vma) return NULL;
+    vma_setup(vma, start, end, flags, name, (flags & VMA_DEMAND) ? anon_fault : NULL);
+    
+    if (!vma_insert(as, vma)) {
+        kmem_cache_free(vma_cache, vma);
+        return NULL;
+    }
+    return vma;
+}
+
+// Remove a region created by as_map, freeing the frames behind demand-zero pages
+bool as_unmap(address_space_t* as, vma_t* vma)
+{
+    if (!vma || (vma->flags & VMA_FIXED)) return false;
+    
+    vma_remove(as, vma);
+    if (vma->fault == anon_fault) {
+        for (uint32_t addr = vma->start; addr < vma->end; addr += PAGE_SIZE) {
+            uint32_t phys = paging_unmap_page((void*)addr);
+            if (phys) frame_free(phys);
+        }
+    }
+    kmem_cache_free(vma_cache, vma);
+    return true;
+}
+
+// Tear down every region that was not set up at boot
+void as_clear(address_space_t* as)
+{
+    vma_t* vma = vma_first(as);
+    while (vma) {
+        vma_t* next = vma_next(vma);
+        as_unmap(as, vma);
+        vma = next;
+    }
+}
+
+// Resolve a not-present fault through the region covering addr
+bool vma_handle_fault(uint32_t addr, bool write)
+{
+    vma_t* vma = vma_find(current_space, addr);
+    if (!vma || !vma->fault) return false;
+    if (write && !(vma->flags & VMA_WRITE)) return false;
+    return vma->fault(vma, addr);
+}
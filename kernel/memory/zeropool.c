@@ -0,0 +1,91 @@
+#include "memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Frames zeroed ahead of time by the idle loop, handed out as a stack
+static uint32_t pool[ZERO_POOL_SIZE];
+static uint32_t pool_depth = 0;
+static zero_pool_stats_t pool_stats;
+
+void clear_page(void* addr)
+{
+    uint32_t dwords = PAGE_SIZE / 4;
+    asm volatile("rep stosl"
+                 : "+D"(addr), "+c"(dwords)
+                 : "a"(0)
+                 : "memory");
+}
+
+// A zero-filled frame; returns its physical address or 0 if memory is exhausted
+uint32_t zero_page_alloc(void)
+{
+    uint32_t flags = irq_save();
+    if (pool_depth > 0) {
+        uint32_t phys = pool[--pool_depth];
+        pool_stats.hits++;
+        irq_restore(flags);
+        return phys;
+    }
+    pool_stats.misses++;
+    irq_restore(flags);
+    
+    uint32_t phys = frame_alloc();
+    if (phys) {
+        clear_page((void*)phys);
+    }
+    return phys;
+}
+
+// Zero one more frame for the pool; returns false once it is full
+bool zero_pool_refill(void)
+{
+    if (pool_depth >= ZERO_POOL_SIZE) return false;
+    
+    // Keep the last free frames for real allocations
+    if (frame_get_free_count() <= ZERO_POOL_SIZE) return false;
+    
+    uint32_t phys = frame_alloc();
+    if (!phys) return false;
+    clear_page((void*)phys);
+    
+    uint32_t flags = irq_save();
+    if (pool_depth < ZERO_POOL_SIZE) {
+        pool[pool_depth++] = phys;
+        pool_stats.idle_zeroed++;
+        phys = 0;
+    }
+    irq_restore(flags);
+    
+    // Someone filled the pool while this frame was being cleared
+    if (phys) frame_free(phys);
+    return true;
+}
+
+// Give up to pages pooled frames back to the frame allocator
+uint32_t zero_pool_drain(uint32_t pages)
+{
+    uint32_t drained = 0;
+    while (drained < pages) {
+        uint32_t flags = irq_save();
+        uint32_t phys = pool_depth > 0 ? pool[--pool_depth] : 0;
+        irq_restore(flags);
+        
+        if (!phys) break;
+        frame_free(phys);
+        drained++;
+    }
+    return drained;
+}
+
+uint32_t zero_pool_get_depth(void)
+{
+    return pool_depth;
+}
+
+void zero_pool_get_stats(zero_pool_stats_t* stats)
+{
+    *stats = pool_stats;
+    stats->depth = pool_depth;
+    stats->capacity = ZERO_POOL_SIZE;
+}
@@ -0,0 +1,772 @@
+#include "sched.h"
+#include "../memory/memory.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+#include "../drivers/drivers.h"
+#include "../time/time.h"
+#include "../smp.h"
+
+// Preemptive priority scheduler for kernel threads. Ready threads wait in
+// one FIFO per priority, and a bitmap of non-empty queues makes picking the
+// highest priority a single bsf, so enqueue, dequeue and pick-next are all
+// constant time. Threads of equal priority share the CPU round robin.
+//
+// The PIT handler charges the running thread one tick per interrupt; once
+// its slice runs out, or a higher priority thread is ready, the switch
+// happens on the way out of the interrupt, after the EOI, so the next
+// thread starts with the timer unmasked.
+//
+// Every CPU has run queues of its own, under a spinlock of its own, and
+// its own running thread, idle thread and reschedule flag in its cpu_t. A
+// thread that becomes ready is queued on an idle CPU, the one it last ran
+// on if that is idle, else on the CPU running the least important thread
+// below it; a CPU other than the caller's is told with a reschedule IPI.
+// Only the target's queue lock is taken for that.
+//
+// A CPU whose queues run dry steals from another, trying them in order
+// from a random one so that several thieves spread over the victims. It
+// takes the victim's least important, most recently queued thread, leaving
+// the one the victim runs next where it is. An idle CPU looks for work and
+// steals holding nothing but queue locks, one at a time; it only takes the
+// kernel lock to switch to what it found.
+//
+// The queues are locked FIFOs rather than work-stealing deques with a
+// lock-free owner end. Such a deque lets only its owner push, and the
+// owner pops what it pushed last. Here other CPUs queue wakeups onto a
+// CPU, a preempted thread has to go behind its equals, and a priority
+// change takes a thread out of the middle of a queue. Each queue lock is
+// only contended by a CPU queueing or stealing work, and is held for a few
+// pointer updates.
+//
+// Every context switch happens under the kernel lock that irq_save takes.
+// The lock is held across the switch and handed to the thread switched in,
+// along with its nesting depth. So a thread queued by a CPU that is still
+// switching away from it cannot run elsewhere before its stack is saved:
+// whoever dequeues it waits for the lock before switching to it.
+
+extern void switch_context(uint32_t* old_esp, uint32_t new_esp);
+
+// The thread running on this CPU; NULL until the CPU joins the scheduler
+#define current (this_cpu()->thread)
+
+static thread_t boot_thread;
+static thread_t* thread_list = NULL;
+typedef struct {
+    thread_t* head;
+    thread_t* tail;
+    uint32_t length;
+} run_queue_t;
+
+// One CPU's ready threads. The queues, bitmap and length change only under
+// lock; the steal counters only on the owning CPU.
+typedef struct {
+    spinlock_t lock;
+    run_queue_t queues[SCHED_PRIORITIES];
+    uint32_t bitmap;                    // Bit n set: queues[n] is not empty
+    volatile uint32_t length;           // Read without the lock as a hint
+    uint32_t steal_seed;                // xorshift state for picking victims
+    uint32_t steals;
+    uint32_t steal_misses;
+} cpu_rq_t;
+
+static cpu_rq_t run_queues[SMP_MAX_CPUS];   // Indexed by CPU id
+static thread_t* dead_list = NULL;      // Exited threads whose stacks are still to be freed
+static uint32_t next_id = 0;
+static sched_stats_t sched_stats;
+
+// Idle accounting in TSC cycles, per CPU in its cpu_t; the clock rate
+// cancels out of the ratios
+static volatile uint32_t idle_monitor;  // Cache line MWAIT watches
+static ktimer_t load_timer;
+static uint64_t load_last_total;
+static uint64_t load_last_idle;
+
+static inline uint32_t find_first_set(uint32_t word)
+{
+    uint32_t bit;
+    asm("bsf %1, %0" : "=r"(bit) : "r"(word));
+    return bit;
+}
+
+static inline uint32_t find_last_set(uint32_t word)
+{
+    uint32_t bit;
+    asm("bsr %1, %0" : "=r"(bit) : "r"(word));
+    return bit;
+}
+
+// Queue on thread->cpu; interrupts must be disabled
+static void run_enqueue(thread_t* thread)
+{
+    cpu_rq_t* rq = &run_queues[thread->cpu];
+    run_queue_t* queue = &rq->queues[thread->priority];
+    spin_lock(&rq->lock);
+    thread->next_run = NULL;
+    if (queue->tail) {
+        queue->tail->next_run = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+    queue->length++;
+    rq->bitmap |= 1u << thread->priority;
+    rq->length++;
+    spin_unlock(&rq->lock);
+}
+
+// Unlink thread, which follows prev in queue; rq must be locked
+static void rq_unlink(cpu_rq_t* rq, run_queue_t* queue, thread_t* prev, thread_t* thread)
+{
+    if (prev) {
+        prev->next_run = thread->next_run;
+    } else {
+        queue->head = thread->next_run;
+    }
+    if (queue->tail == thread) queue->tail = prev;
+    thread->next_run = NULL;
+    if (--queue->length == 0) rq->bitmap &= ~(1u << thread->priority);
+    rq->length--;
+}
+
+// Take thread off whichever queue it is on; false if it is on none, e.g.
+// because a thief dequeued it. Interrupts must be disabled.
+static bool run_remove(thread_t* thread)
+{
+    // A thief moves a thread to itself under the victim's lock
+    cpu_rq_t* rq;
+    while (1) {
+        rq = &run_queues[thread->cpu];
+        spin_lock(&rq->lock);
+        if (rq == &run_queues[thread->cpu]) break;
+        spin_unlock(&rq->lock);
+    }
+    
+    run_queue_t* queue = &rq->queues[thread->priority];
+    thread_t* prev = NULL;
+    thread_t* node = queue->head;
+    while (node && node != thread) {
+        prev = node;
+        node = node->next_run;
+    }
+    if (node) rq_unlink(rq, queue, prev, thread);
+    spin_unlock(&rq->lock);
+    return node != NULL;
+}
+
+// Highest priority ready thread of rq, or NULL; interrupts must be disabled
+static thread_t* run_dequeue(cpu_rq_t* rq)
+{
+    if (!rq->length) return NULL;
+    
+    spin_lock(&rq->lock);
+    thread_t* thread = NULL;
+    if (rq->bitmap) {
+        run_queue_t* queue = &rq->queues[find_first_set(rq->bitmap)];
+        thread = queue->head;
+        rq_unlink(rq, queue, NULL, thread);
+    }
+    spin_unlock(&rq->lock);
+    return thread;
+}
+
+// The victim's least important, most recently queued thread, now queued
+// nowhere and belonging to cpu; NULL if the victim has none
+static thread_t* run_steal_from(cpu_rq_t* victim, cpu_t* cpu)
+{
+    spin_lock(&victim->lock);
+    thread_t* thread = NULL;
+    if (victim->bitmap) {
+        run_queue_t* queue = &victim->queues[find_last_set(victim->bitmap)];
+        thread_t* prev = NULL;
+        thread = queue->head;
+        while (thread->next_run) {
+            prev = thread;
+            thread = thread->next_run;
+        }
+        rq_unlink(victim, queue, prev, thread);
+        thread->cpu = cpu->id;
+    }
+    spin_unlock(&victim->lock);
+    return thread;
+}
+
+static uint32_t steal_random(cpu_rq_t* rq)
+{
+    uint32_t x = rq->steal_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rq->steal_seed = x;
+    return x;
+}
+
+// This CPU's queues are empty: take a thread from another CPU. Needs only
+// the victims' locks; interrupts must be disabled.
+static thread_t* run_steal(cpu_t* cpu)
+{
+    uint32_t count = smp_cpu_count();
+    if (count < 2) return NULL;
+    
+    cpu_rq_t* rq = &run_queues[cpu->id];
+    uint32_t start = steal_random(rq) % count;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t victim = (start + i) % count;
+        if (victim == cpu->id || !run_queues[victim].length) continue;
+        
+        thread_t* thread = run_steal_from(&run_queues[victim], cpu);
+        if (thread) {
+            rq->steals++;
+            return thread;
+        }
+        rq->steal_misses++;
+    }
+    return NULL;
+}
+
+// Highest priority thread queued here, else one stolen from another CPU
+static thread_t* run_pick(cpu_t* cpu)
+{
+    thread_t* next = run_dequeue(&run_queues[cpu->id]);
+    return next ? next : run_steal(cpu);
+}
+
+// Idle and not about to look at its queues anyway
+static bool cpu_is_idle(cpu_t* cpu)
+{
+    return cpu->thread && cpu->thread == cpu->idle && !cpu->need_resched;
+}
+
+// A thread just became ready: queue it where it runs soonest, and make
+// sure that CPU reschedules. Must be inside irq_save; of the queue locks it
+// takes only the target's.
+static void sched_enqueue(thread_t* thread)
+{
+    cpu_t* last = smp_cpu(thread->cpu);
+    cpu_t* target = cpu_is_idle(last) ? last : NULL;
+    for (uint32_t i = 0; i < smp_cpu_count() && !target; i++) {
+        cpu_t* cpu = smp_cpu(i);
+        if (cpu_is_idle(cpu)) target = cpu;
+    }
+    
+    // No idle CPU: preempt the least important thread below this one
+    for (uint32_t i = 0; i < smp_cpu_count() && !target; i++) {
+        cpu_t* cpu = smp_cpu(i);
+        if (!cpu->thread || cpu->need_resched || cpu->thread->priority <= thread->priority) continue;
+        if (!target || cpu->thread->priority > target->thread->priority) target = cpu;
+    }
+    
+    // Every CPU is on more important work: wait where the caches are warm
+    cpu_t* queue_cpu = target ? target : last;
+    if (queue_cpu->id != thread->cpu) {
+        thread->cpu = queue_cpu->id;
+        sched_stats.migrations++;
+    }
+    run_enqueue(thread);
+    
+    if (target) {
+        target->need_resched = true;
+        smp_send_reschedule(target);
+    }
+}
+
+static void unlink_thread(thread_t* thread)
+{
+    thread_t** link = &thread_list;
+    while (*link && *link != thread) {
+        link = &(*link)->next;
+    }
+    if (*link) *link = thread->next;
+}
+
+// A thread cannot free the stack it runs on, so whoever runs next does it
+static void reap_dead(void)
+{
+    while (dead_list) {
+        thread_t* thread = dead_list;
+        dead_list = thread->next_run;
+        free_pages(thread->stack, THREAD_STACK_ORDER);
+        kfree(thread);
+    }
+}
+
+// Switch this CPU from the running thread to next, which is queued
+// nowhere; must be inside irq_save
+static void context_switch(cpu_t* cpu, thread_t* next)
+{
+    thread_t* prev = current;
+    next->state = THREAD_RUNNING;
+    next->slice_left = sched_stats.slice;
+    cpu->need_resched = false;
+    if (next == prev) return;
+    
+    if (prev == cpu->idle) {
+        cpu->idle_cycles += rdtsc() - cpu->idle_since;
+        tick_restart();
+    }
+    if (next == cpu->idle) cpu->idle_since = rdtsc();
+    
+    cpu->thread = next;
+    next->cpu = cpu->id;
+    next->switches++;
+    sched_stats.context_switches++;
+    prev->lock_depth = cpu->lock_depth;
+    switch_context(&prev->esp, next->esp);
+    
+    // Back on prev's stack, not necessarily on the same CPU
+    this_cpu()->lock_depth = prev->lock_depth;
+    reap_dead();
+}
+
+// Pick the next thread and switch to it; must be inside irq_save
+static void schedule(void)
+{
+    cpu_t* cpu = this_cpu();
+    thread_t* prev = current;
+    if (prev->state == THREAD_RUNNING) {
+        prev->state = THREAD_READY;
+        if (prev != cpu->idle) run_enqueue(prev);
+    }
+    
+    thread_t* next = run_pick(cpu);
+    if (!next) next = cpu->idle;
+    if (!next) {
+        kernel_panic("schedule: no runnable thread");
+        return;
+    }
+    context_switch(cpu, next);
+}
+
+// First code run by every new thread; switch_context "returns" here with
+// the kernel lock held once, on behalf of the new thread
+static void thread_start(void)
+{
+    this_cpu()->lock_depth = current->lock_depth;
+    reap_dead();
+    irq_restore(EFLAGS_IF);
+    
+    current->entry(current->arg);
+    thread_exit();
+}
+
+// Sleep until an interrupt; called with interrupts disabled, returns with
+// them enabled. sti only takes effect after the next instruction, so an
+// interrupt cannot slip in between the last check and the halt.
+static void cpu_idle(void)
+{
+    if (sched_stats.mwait) {
+        asm volatile("monitor" : : "a"(&idle_monitor), "c"(0), "d"(0));
+        asm volatile("sti; mwait" : : "a"(0), "c"(0) : "memory");
+    } else {
+        asm volatile("sti; hlt" : : : "memory");
+    }
+}
+
+// Idle housekeeping, then halt until an interrupt posts work
+static void idle_loop(void* arg)
+{
+    UNUSED(arg);
+    
+    while (1) {
+        // Reclaim memory under pressure and zero pages ahead of demand
+        if (shrink_poll() || zero_pool_refill()) continue;
+        
+        // Look for work, here or on other CPUs, without the kernel lock
+        uint32_t flags = local_irq_save();
+        cpu_t* cpu = this_cpu();
+        thread_t* next = run_pick(cpu);
+        if (next) {
+            uint32_t irq = irq_save();
+            cpu->idle->state = THREAD_READY;
+            context_switch(cpu, next);
+            irq_restore(irq);
+            local_irq_restore(flags);
+            continue;
+        }
+        
+        // Dynamic tick: nothing needs the timer before the next deadline.
+        // Interrupts stay masked; a reschedule IPI sent from here on stays
+        // pending until cpu_idle halts.
+        uint32_t irq = irq_save();
+        if (tick_nohz()) tick_stop(ktimer_next_deadline());
+        irq_restore(irq);
+        cpu_idle();
+    }
+}
+
+// Sums over the CPUs running threads; must be inside irq_save
+static uint64_t idle_cycles_now(void)
+{
+    uint64_t now = rdtsc();
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_cpu(i);
+        if (!cpu->idle) continue;
+        cycles += cpu->idle_cycles;
+        if (cpu->thread == cpu->idle && now > cpu->idle_since) cycles += now - cpu->idle_since;
+    }
+    return cycles;
+}
+
+static uint64_t total_cycles_now(void)
+{
+    uint64_t now = rdtsc();
+    uint64_t cycles = 0;
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_cpu(i);
+        if (cpu->idle && now > cpu->start_tsc) cycles += now - cpu->start_tsc;
+    }
+    return cycles;
+}
+
+// Busy share of one cycle count against another, in percent
+static uint32_t cycles_busy_percent(uint64_t idle, uint64_t total)
+{
+    if (total == 0 || idle >= total) return 0;
+    
+    // Scale both down until the divisor fits div_u64
+    while (total > 0xFFFFFFFFull) {
+        total >>= 1;
+        idle >>= 1;
+    }
+    return (uint32_t)div_u64((total - idle) * 100, (uint32_t)total);
+}
+
+// Runs in ktimerd once a second
+static void load_sample(void* arg)
+{
+    UNUSED(arg);
+    
+    uint32_t irq = irq_save();
+    uint64_t total = total_cycles_now();
+    uint64_t idle = idle_cycles_now();
+    sched_stats.load_percent = cycles_busy_percent(idle - load_last_idle, total - load_last_total);
+    load_last_total = total;
+    load_last_idle = idle;
+    irq_restore(irq);
+}
+
+// The code running since boot becomes the first thread
+void sched_init(void)
+{
+    memset(&sched_stats, 0, sizeof(sched_stats));
+    sched_stats.slice = SCHED_DEFAULT_SLICE;
+    sched_stats.mwait = cpu_has_feature_ecx(CPUID_ECX_MONITOR);
+    sched_stats.cpus = 1;
+    this_cpu()->start_tsc = rdtsc();
+    run_queues[0].steal_seed = (uint32_t)rdtsc() | 1;
+    
+    memset(&boot_thread, 0, sizeof(boot_thread));
+    boot_thread.id = next_id++;
+    strncpy(boot_thread.name, "kmain", THREAD_NAME_LEN - 1);
+    boot_thread.state = THREAD_RUNNING;
+    boot_thread.priority = SCHED_PRIO_DEFAULT;
+    boot_thread.slice_left = sched_stats.slice;
+    
+    thread_list = &boot_thread;
+    current = &boot_thread;
+    sched_stats.threads = 1;
+    
+    // Below every real priority, so any ready thread preempts it
+    thread_t* idle = thread_create("idle0", idle_loop, NULL);
+    if (!idle) {
+        kernel_panic("sched_init: cannot create the idle thread");
+        return;
+    }
+    uint32_t irq = irq_save();
+    run_remove(idle);
+    idle->priority = SCHED_PRIORITIES;
+    this_cpu()->idle = idle;
+    irq_restore(irq);
+    
+    ktimer_start();
+    ktimer_init(&load_timer, load_sample, NULL);
+    ktimer_add_periodic(&load_timer, 1000);
+}
+
+// An application processor joins: the code running on its boot stack
+// becomes its idle thread, and never returns from here
+void sched_start_cpu(void)
+{
+    uint32_t irq = irq_save();
+    cpu_t* cpu = this_cpu();
+    thread_t* idle = (thread_t*)kmalloc(sizeof(thread_t));
+    if (!idle) {
+        kernel_panic("sched_start_cpu: cannot create the idle thread");
+        return;
+    }
+    memset(idle, 0, sizeof(thread_t));
+    idle->id = next_id++;
+    strncpy(idle->name, "idle", THREAD_NAME_LEN - 1);
+    itoa(cpu->id, idle->name + 4, 10);
+    idle->state = THREAD_RUNNING;
+    idle->priority = SCHED_PRIORITIES;
+    idle->stack = cpu->stack_top - THREAD_STACK_SIZE;
+    idle->cpu = cpu->id;
+    idle->next = thread_list;
+    thread_list = idle;
+    sched_stats.threads++;
+    sched_stats.cpus++;
+    
+    run_queues[cpu->id].steal_seed = ((uint32_t)rdtsc() * (cpu->id + 1)) | 1;
+    cpu->idle = idle;
+    cpu->thread = idle;
+    cpu->idle_since = rdtsc();
+    tick_start_cpu();
+    irq_restore(irq);
+    
+    idle_loop(NULL);
+}
+
+thread_t* thread_create(const char* name, thread_fn_t entry, void* arg)
+{
+    thread_t* thread = (thread_t*)kmalloc(sizeof(thread_t));
+    if (!thread) return NULL;
+    memset(thread, 0, sizeof(thread_t));
+    
+    // Stacks come from the identity map: a not-present stack page would turn
+    // the next interrupt into a double fault
+    thread->stack = alloc_pages(THREAD_STACK_ORDER);
+    if (!thread->stack) {
+        kfree(thread);
+        return NULL;
+    }
+    
+    strncpy(thread->name, name, THREAD_NAME_LEN - 1);
+    thread->priority = current && current->priority < SCHED_PRIORITIES ? current->priority : SCHED_PRIO_DEFAULT;
+    thread->entry = entry;
+    thread->arg = arg;
+    thread->lock_depth = 1;
+    thread->cpu = this_cpu()->id;
+    
+    // Frame popped by switch_context: edi, esi, ebx, ebp, then the return
+    // address; thread_start never returns, so its own return slot is 0
+    uint32_t* sp = (uint32_t*)(thread->stack + THREAD_STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uint32_t)thread_start;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    thread->esp = (uint32_t)sp;
+    
+    uint32_t irq = irq_save();
+    thread->id = next_id++;
+    thread->state = THREAD_READY;
+    thread->next = thread_list;
+    thread_list = thread;
+    sched_stats.threads++;
+    sched_enqueue(thread);
+    irq_restore(irq);
+    return thread;
+}
+
+void thread_exit(void)
+{
+    irq_save();
+    if (current == &boot_thread) {
+        kernel_panic("thread_exit: the boot thread cannot exit");
+        return;
+    }
+    
+    current->state = THREAD_DEAD;
+    unlink_thread(current);
+    sched_stats.threads--;
+    current->next_run = dead_list;
+    dead_list = current;
+    schedule();
+}
+
+void thread_yield(void)
+{
+    if (!current) return;
+    
+    uint32_t irq = irq_save();
+    sched_stats.yields++;
+    schedule();
+    irq_restore(irq);
+}
+
+thread_t* thread_current(void)
+{
+    return current;
+}
+
+thread_t* thread_first(void)
+{
+    return thread_list;
+}
+
+bool thread_set_priority(thread_t* thread, uint32_t priority)
+{
+    if (priority >= SCHED_PRIORITIES || thread->priority == SCHED_PRIORITIES) return false;
+    
+    uint32_t irq = irq_save();
+    if (thread->state == THREAD_READY && run_remove(thread)) {
+        thread->priority = priority;
+        sched_enqueue(thread);
+    } else {
+        thread->priority = priority;
+    }
+    
+    // A running thread that now ranks below one ready on its CPU gives way
+    // at the next interrupt there
+    cpu_rq_t* rq = &run_queues[thread->cpu];
+    if (thread->state == THREAD_RUNNING && rq->bitmap && find_first_set(rq->bitmap) < priority) {
+        cpu_t* cpu = smp_cpu(thread->cpu);
+        cpu->need_resched = true;
+        smp_send_reschedule(cpu);
+    }
+    irq_restore(irq);
+    return true;
+}
+
+// Take the running thread off the CPU until thread_wake; must be inside irq_save
+static void thread_block(void)
+{
+    current->state = THREAD_BLOCKED;
+    schedule();
+}
+
+void thread_wake(thread_t* thread)
+{
+    uint32_t irq = irq_save();
+    if (thread->state == THREAD_BLOCKED) {
+        thread->state = THREAD_READY;
+        sched_enqueue(thread);
+    }
+    irq_restore(irq);
+}
+
+void wait_queue_init(wait_queue_t* queue)
+{
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+// Block the caller on queue. Call with interrupts disabled after checking the
+// condition, and check it again after waking:
+//     irq = irq_save(); while (!cond) wait_queue_sleep(&q); irq_restore(irq);
+void wait_queue_sleep(wait_queue_t* queue)
+{
+    thread_t* thread = current;
+    thread->next_run = NULL;
+    if (queue->tail) {
+        queue->tail->next_run = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+    thread_block();
+}
+
+void wake_up_one(wait_queue_t* queue)
+{
+    uint32_t irq = irq_save();
+    thread_t* thread = queue->head;
+    if (thread) {
+        queue->head = thread->next_run;
+        if (!queue->head) queue->tail = NULL;
+        thread->next_run = NULL;
+        thread_wake(thread);
+    }
+    irq_restore(irq);
+}
+
+void wake_up(wait_queue_t* queue)
+{
+    uint32_t irq = irq_save();
+    while (queue->head) {
+        wake_up_one(queue);
+    }
+    irq_restore(irq);
+}
+
+// Runs in ktimerd
+static void sleep_timeout(void* arg)
+{
+    thread_wake((thread_t*)arg);
+}
+
+// Block for at least milliseconds; spins only before the scheduler is up
+void thread_sleep_ms(uint32_t milliseconds)
+{
+    if (milliseconds == 0) return;
+    
+    if (!current || current == this_cpu()->idle) {
+        uint32_t start = pit_get_ticks();
+        while (pit_get_ticks() - start < milliseconds) {
+            asm volatile("pause");
+        }
+        return;
+    }
+    
+    // The timer lives on this stack, which stays put while the thread sleeps
+    ktimer_t timer;
+    ktimer_init(&timer, sleep_timeout, current);
+    
+    uint32_t irq = irq_save();
+    ktimer_add(&timer, milliseconds);
+    while (timer.pending) {
+        thread_block();
+    }
+    irq_restore(irq);
+}
+
+// Tick interrupt: charge the thread running on this CPU
+void sched_tick(void)
+{
+    if (!current) return;
+    
+    current->ticks++;
+    if (current->slice_left > 0) current->slice_left--;
+    
+    cpu_rq_t* rq = &run_queues[this_cpu()->id];
+    if (rq->bitmap) {
+        uint32_t best = find_first_set(rq->bitmap);
+        if (best < current->priority || (best == current->priority && current->slice_left == 0)) {
+            this_cpu()->need_resched = true;
+            return;
+        }
+    }
+    
+    // Nothing to share the CPU with: start a fresh slice instead of switching to itself
+    if (current->slice_left == 0) {
+        current->slice_left = sched_stats.slice;
+    }
+}
+
+// Last thing an interrupt does before returning; the EOI has been sent
+void sched_irq_exit(void)
+{
+    if (!current || !this_cpu()->need_resched) return;
+    
+    sched_stats.preemptions++;
+    schedule();
+}
+
+void sched_set_slice(uint32_t ticks)
+{
+    if (ticks == 0) ticks = 1;
+    sched_stats.slice = ticks;
+}
+
+void sched_get_stats(sched_stats_t* stats)
+{
+    uint32_t irq = irq_save();
+    *stats = sched_stats;
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        cpu_rq_t* rq = &run_queues[cpu];
+        for (uint32_t prio = 0; prio < SCHED_PRIORITIES; prio++) {
+            stats->queue_length[prio] += rq->queues[prio].length;
+        }
+        stats->cpu_queue_length[cpu] = rq->length;
+        stats->steals += rq->steals;
+        stats->steal_misses += rq->steal_misses;
+        stats->migrations += rq->steals;
+    }
+    stats->idle_cycles = idle_cycles_now();
+    stats->total_cycles = total_cycles_now();
+    stats->busy_percent = cycles_busy_percent(stats->idle_cycles, stats->total_cycles);
+    irq_restore(irq);
+}
@@ -0,0 +1,120 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../smp.h"
+
+#define THREAD_NAME_LEN 16
+#define THREAD_STACK_ORDER 2            // 16 KiB kernel stacks
+#define THREAD_STACK_SIZE (4096u << THREAD_STACK_ORDER)
+#define SCHED_DEFAULT_SLICE 10          // PIT ticks (ms) before a thread is preempted
+#define SCHED_PRIORITIES 32             // 0 is the highest priority
+#define SCHED_PRIO_DEFAULT 16
+
+typedef enum {
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state_t;
+
+typedef void (*thread_fn_t)(void* arg);
+
+typedef struct thread {
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    thread_state_t state;
+    uint32_t priority;
+    uint32_t esp;               // Saved stack pointer while switched out
+    uint32_t stack;             // Base of the stack block, 0 for the boot thread
+    thread_fn_t entry;
+    void* arg;
+    uint32_t slice_left;        // Ticks until preemption
+    uint32_t ticks;             // Ticks spent running
+    uint32_t switches;          // Times switched in
+    uint32_t cpu;               // CPU it runs or last ran on
+    uint32_t lock_depth;        // The CPU's kernel lock depth while switched out
+    struct thread* next_run;    // Run queue or wait queue link
+    struct thread* next;        // All threads
+} thread_t;
+
+typedef struct {
+    uint32_t threads;
+    uint32_t context_switches;
+    uint32_t preemptions;       // Switches forced from an interrupt
+    uint32_t yields;
+    uint32_t slice;
+    uint32_t cpus;              // CPUs running threads
+    uint32_t queue_length[SCHED_PRIORITIES];    // Ready threads per priority
+    uint32_t cpu_queue_length[SMP_MAX_CPUS];    // Ready threads per CPU
+    uint32_t steals;            // Threads an idle CPU took from another's queues
+    uint32_t steal_misses;      // CPUs a thief found with nothing to take
+    uint32_t migrations;        // Threads moved to another CPU, steals included
+    uint64_t idle_cycles;       // TSC cycles spent in idle threads, summed over CPUs
+    uint64_t total_cycles;
+    uint32_t busy_percent;      // Busy share since sched_init
+    uint32_t load_percent;      // Busy share of the last second
+    bool mwait;                 // Idle waits with MONITOR/MWAIT rather than HLT
+} sched_stats_t;
+
+void sched_init(void);
+void sched_start_cpu(void);
+thread_t* thread_create(const char* name, thread_fn_t entry, void* arg);
+void thread_exit(void);
+void thread_yield(void);
+thread_t* thread_current(void);
+thread_t* thread_first(void);
+bool thread_set_priority(thread_t* thread, uint32_t priority);
+
+// Called from interrupt context
+void sched_tick(void);
+void sched_irq_exit(void);
+
+void sched_set_slice(uint32_t ticks);
+void sched_get_stats(sched_stats_t* stats);
+
+// Blocking: threads wait on a queue until someone wakes them
+typedef struct {
+    thread_t* head;
+    thread_t* tail;
+} wait_queue_t;
+
+void wait_queue_init(wait_queue_t* queue);
+void wait_queue_sleep(wait_queue_t* queue);
+void wake_up(wait_queue_t* queue);
+void wake_up_one(wait_queue_t* queue);
+void thread_wake(thread_t* thread);
+void thread_sleep_ms(uint32_t milliseconds);
+
+// Kernel timers on a timing wheel driven by the PIT tick; callbacks run
+// in the ktimerd thread and must not sleep
+typedef void (*ktimer_fn_t)(void* arg);
+
+typedef struct ktimer {
+    uint32_t expires;           // PIT tick the timer fires at
+    uint32_t period;            // Ticks between firings, 0 for one-shot
+    ktimer_fn_t fn;
+    void* arg;
+    bool pending;
+    struct ktimer* next;        // Wheel slot or expired list
+    struct ktimer** pprev;      // Link pointing at this timer
+} ktimer_t;
+
+typedef struct {
+    uint32_t pending;
+    uint32_t fired;
+    uint32_t cascaded;          // Timers moved down a level of the wheel
+} ktimer_stats_t;
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* arg);
+void ktimer_add(ktimer_t* timer, uint32_t delay_ms);
+void ktimer_add_periodic(ktimer_t* timer, uint32_t period_ms);
+bool ktimer_cancel(ktimer_t* timer);
+void ktimer_tick(uint32_t now);
+uint32_t ktimer_next_deadline(void);
+void ktimer_start(void);
+void ktimer_get_stats(ktimer_stats_t* stats);
+
+#endif
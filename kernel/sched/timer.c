@@ -0,0 +1,256 @@
+#include "sched.h"
+#include "../drivers/drivers.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+#include "../time/time.h"
+
+// Kernel timers on a hierarchical timing wheel. Level 0 has one slot per
+// tick for the next 256 ticks; each level above has 64 slots, each covering
+// a whole turn of the level below. A timer is filed by how far away it is,
+// so adding and cancelling are constant time. When a lower level wraps
+// around, the next slot of the level above is cascaded: its timers are
+// filed again, now one level closer. Every timer cascades at most once per
+// level, so expiry is amortized constant time.
+//
+// The tick interrupt only moves due timers to the expired list; the
+// callbacks run in the "ktimerd" thread, at the highest priority, with
+// interrupts enabled. Callbacks must not sleep.
+
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_ROOT_SIZE (1u << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1u << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_LEVELS 3                  // Above the root
+#define WHEEL_MAX_DELTA ((1u << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+
+static ktimer_t* wheel_root[WHEEL_ROOT_SIZE];
+static ktimer_t* wheel_levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+static uint32_t wheel_now = 0;          // Next tick to process
+static ktimer_t* expired = NULL;        // Due, waiting for ktimerd
+static wait_queue_t ktimerd_wait;
+static ktimer_stats_t ktimer_stats;
+
+// Wrap-safe: true if tick a is at or after tick b
+static bool tick_after_eq(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) >= 0;
+}
+
+static void list_add(ktimer_t** head, ktimer_t* timer)
+{
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+}
+
+// Constant time: the timer knows the link that points at it
+static void list_del(ktimer_t* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static uint32_t level_index(uint32_t tick, uint32_t level)
+{
+    return (tick >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK;
+}
+
+// File a timer by its distance from wheel_now; interrupts must be disabled
+static void wheel_add(ktimer_t* timer)
+{
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - wheel_now;
+    
+    if ((int32_t)delta < 0) {
+        // Already due: the next tick processed picks it up
+        list_add(&wheel_root[wheel_now & WHEEL_ROOT_MASK], timer);
+        return;
+    }
+    if (delta < WHEEL_ROOT_SIZE) {
+        list_add(&wheel_root[expires & WHEEL_ROOT_MASK], timer);
+        return;
+    }
+    
+    // Too far for the wheel: park it in the farthest slot, it cascades again
+    if (delta > WHEEL_MAX_DELTA) expires = wheel_now + WHEEL_MAX_DELTA;
+    
+    uint32_t level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           (expires - wheel_now) >= (1u << (WHEEL_ROOT_BITS + (level + 1) * WHEEL_LEVEL_BITS))) {
+        level++;
+    }
+    list_add(&wheel_levels[level][level_index(expires, level)], timer);
+}
+
+// Refile one slot of a higher level; returns the slot index
+static uint32_t cascade(uint32_t level)
+{
+    uint32_t index = level_index(wheel_now, level);
+    ktimer_t* timer = wheel_levels[level][index];
+    wheel_levels[level][index] = NULL;
+    
+    while (timer) {
+        ktimer_t* next = timer->next;
+        wheel_add(timer);
+        ktimer_stats.cascaded++;
+        timer = next;
+    }
+    return index;
+}
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* arg)
+{
+    memset(timer, 0, sizeof(ktimer_t));
+    timer->fn = fn;
+    timer->arg = arg;
+}
+
+static void timer_arm(ktimer_t* timer, uint32_t delay_ms, uint32_t period_ms)
+{
+    // Deadlines more than half the tick range away would compare as past
+    if (delay_ms > 0x7FFFFFFF) delay_ms = 0x7FFFFFFF;
+    
+    uint32_t irq = irq_save();
+    if (timer->pending) {
+        list_del(timer);
+    } else {
+        ktimer_stats.pending++;
+    }
+    timer->expires = pit_get_ticks() + delay_ms;
+    timer->period = period_ms;
+    timer->pending = true;
+    wheel_add(timer);
+    tick_timer_armed(timer->expires);
+    irq_restore(irq);
+}
+
+// Fire fn(arg) once, delay_ms from now; re-arming a pending timer moves it
+void ktimer_add(ktimer_t* timer, uint32_t delay_ms)
+{
+    timer_arm(timer, delay_ms, 0);
+}
+
+// Fire fn(arg) every period_ms until cancelled
+void ktimer_add_periodic(ktimer_t* timer, uint32_t period_ms)
+{
+    if (period_ms == 0) period_ms = 1;
+    timer_arm(timer, period_ms, period_ms);
+}
+
+// Returns true if the timer was still pending. A callback already handed
+// to ktimerd may still be running when this returns.
+bool ktimer_cancel(ktimer_t* timer)
+{
+    uint32_t irq = irq_save();
+    bool pending = timer->pending;
+    if (pending) {
+        list_del(timer);
+        timer->pending = false;
+        ktimer_stats.pending--;
+    }
+    irq_restore(irq);
+    return pending;
+}
+
+// Tick interrupt: move everything due up to now to the expired list
+void ktimer_tick(uint32_t now)
+{
+    bool due = false;
+    
+    while (tick_after_eq(now, wheel_now)) {
+        uint32_t index = wheel_now & WHEEL_ROOT_MASK;
+        
+        // The root wrapped: pull the next slot of each level that wrapped too
+        if (index == 0) {
+            for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+                if (cascade(level) != 0) break;
+            }
+        }
+        
+        ktimer_t* timer = wheel_root[index];
+        while (timer) {
+            ktimer_t* next = timer->next;
+            list_del(timer);
+            list_add(&expired, timer);
+            due = true;
+            timer = next;
+        }
+        wheel_now++;
+    }
+    
+    if (due) wake_up(&ktimerd_wait);
+}
+
+// Earliest tick anything may fire at, for stopping the tick while idle.
+// Looks no further than the next root wrap, where a cascade can bring
+// timers from the levels above within reach.
+uint32_t ktimer_next_deadline(void)
+{
+    uint32_t irq = irq_save();
+    uint32_t tick = wheel_now;
+    if (!expired) {
+        while (!wheel_root[tick & WHEEL_ROOT_MASK] && (tick & WHEEL_ROOT_MASK) != 0) {
+            tick++;
+        }
+    }
+    irq_restore(irq);
+    return tick;
+}
+
+// Runs the callbacks of expired timers outside interrupt context
+static void ktimerd(void* arg)
+{
+    UNUSED(arg);
+    
+    while (1) {
+        uint32_t irq = irq_save();
+        while (!expired) {
+            wait_queue_sleep(&ktimerd_wait);
+        }
+        
+        ktimer_t* timer = expired;
+        list_del(timer);
+        if (timer->period) {
+            // Keep the phase, but skip periods missed while the system was busy
+            timer->expires += timer->period;
+            if (!tick_after_eq(timer->expires, pit_get_ticks() + 1)) {
+                timer->expires = pit_get_ticks() + timer->period;
+            }
+            wheel_add(timer);
+        } else {
+            timer->pending = false;
+            ktimer_stats.pending--;
+        }
+        ktimer_fn_t fn = timer->fn;
+        void* fn_arg = timer->arg;
+        ktimer_stats.fired++;
+        irq_restore(irq);
+        
+        fn(fn_arg);
+    }
+}
+
+// Called from sched_init once threads can be created
+void ktimer_start(void)
+{
+    wait_queue_init(&ktimerd_wait);
+    thread_t* thread = thread_create("ktimerd", ktimerd, NULL);
+    if (!thread) {
+        kernel_panic("ktimer_start: cannot create ktimerd");
+        return;
+    }
+    thread_set_priority(thread, 0);
+}
+
+void ktimer_get_stats(ktimer_stats_t* stats)
+{
+    uint32_t irq = irq_save();
+    *stats = ktimer_stats;
+    irq_restore(irq);
+}
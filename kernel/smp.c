@@ -0,0 +1,287 @@
+#include "kernel.h"
+#include "smp.h"
+#include "cpu.h"
+#include "memory/memory.h"
+#include "drivers/drivers.h"
+#include "sched/sched.h"
+#include "time/time.h"
+#include "lib/lib.h"
+
+// Symmetric multiprocessing. The boot CPU finds the others in the MADT and
+// starts each with INIT, STARTUP, STARTUP: the STARTUP IPI makes a CPU
+// execute, in real mode, the trampoline copied to SMP_TRAMPOLINE, which
+// switches it to protected mode with the boot CPU's paging and calls
+// smp_ap_entry on a stack of its own. Every CPU then loads its own GDT,
+// whose per-CPU segment in gs points at its cpu_t, and becomes one more
+// CPU the scheduler can run threads on.
+//
+// Kernel data is protected by one lock, taken by irq_save on top of
+// disabling interrupts: every section that was atomic on one CPU because
+// it ran with interrupts off stays atomic across all of them. Threads run
+// in parallel everywhere else. Hot data of one CPU, such as its run
+// queues, has a spinlock of its own instead, taken after the kernel lock
+// if at all. A CPU spinning for either keeps answering TLB shootdowns,
+// because the CPU holding the kernel lock may be waiting for exactly that.
+
+#define SMP_TRAMPOLINE 0x8000                           // Must match smp_trampoline.asm
+#define SMP_INIT_DELAY_NS (10 * NSEC_PER_MSEC)
+#define SMP_STARTUP_DELAY_NS 200000
+#define SMP_ONLINE_TIMEOUT_NS (100 * NSEC_PER_MSEC)
+
+// Filled in for each CPU started; laid out as at smp_trampoline_params
+typedef struct {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    cpu_t* cpu;
+} __attribute__((packed)) trampoline_params_t;
+
+extern uint8_t smp_trampoline[];
+extern uint8_t smp_trampoline_params[];
+extern uint8_t smp_trampoline_end[];
+extern void idt_flush(void);
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static uint32_t cpu_count = 0;                          // CPUs with a cpu_t, the last maybe still starting
+static volatile uint32_t kernel_lock_word = 0;
+static bool kernel_lock_live = false;                   // Once gs points at a cpu_t
+static smp_stats_t smp_stats;
+
+static inline uint32_t xchg(volatile uint32_t* word, uint32_t value)
+{
+    asm volatile("xchg %0, %1" : "+r"(value), "+m"(*word) : : "memory");
+    return value;
+}
+
+// Carry out what other CPUs asked of this one while it could not take
+// their interrupt
+static void smp_poll(cpu_t* cpu)
+{
+    if (cpu->tlb_flush) {
+        paging_flush_tlb_all();
+        cpu->tlb_flush = false;
+    }
+}
+
+void kernel_lock(void)
+{
+    if (!kernel_lock_live) return;
+    
+    cpu_t* cpu = this_cpu();
+    if (cpu->lock_depth++ > 0) return;
+    if (xchg(&kernel_lock_word, 1) == 0) return;
+    
+    do {
+        while (kernel_lock_word) {
+            smp_poll(cpu);
+            asm volatile("pause");
+        }
+    } while (xchg(&kernel_lock_word, 1) != 0);
+    smp_stats.lock_contended++;
+}
+
+void kernel_unlock(void)
+{
+    if (!kernel_lock_live) return;
+    
+    cpu_t* cpu = this_cpu();
+    if (--cpu->lock_depth > 0) return;
+    
+    // Stores are not reordered with older stores, so this is a release
+    asm volatile("" : : : "memory");
+    kernel_lock_word = 0;
+}
+
+// The boot CPU's cpu_t; gdt_init loads gs with it right away, before
+// anything can take the kernel lock
+cpu_t* smp_boot_cpu(void)
+{
+    cpu_t* cpu = &cpus[0];
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->self = cpu;
+    cpu->online = true;
+    cpu_count = 1;
+    
+    memset(&smp_stats, 0, sizeof(smp_stats));
+    smp_stats.online = 1;
+    kernel_lock_live = true;
+    return cpu;
+}
+
+// Same as the kernel lock, minus the nesting and the statistics
+void spin_lock(spinlock_t* lock)
+{
+    while (xchg(&lock->locked, 1) != 0) {
+        while (lock->locked) {
+            smp_poll(this_cpu());
+            asm volatile("pause");
+        }
+    }
+}
+
+void spin_unlock(spinlock_t* lock)
+{
+    asm volatile("" : : : "memory");
+    lock->locked = 0;
+}
+
+// Busy-wait during bring-up, when interrupts are still disabled
+static void smp_delay_ns(uint64_t ns)
+{
+    uint64_t start = ktime_get_ns();
+    while (ktime_get_ns() - start < ns) {
+        smp_poll(this_cpu());
+        asm volatile("pause");
+    }
+}
+
+// First C code on an application processor, on the stack smp_init gave it
+void smp_ap_entry(cpu_t* cpu)
+{
+    gdt_init_cpu(cpu);
+    idt_flush();
+    pat_init();
+    apic_init_ap();
+    
+    // Page tables only change under the lock; shootdowns reach this CPU
+    // from the moment it is online
+    uint32_t irq = irq_save();
+    paging_flush_tlb_all();
+    cpu->start_tsc = rdtsc();
+    cpu->online = true;
+    smp_stats.online++;
+    irq_restore(irq);
+    
+    sched_start_cpu();
+}
+
+static void smp_start_cpu(uint8_t apic_id, volatile trampoline_params_t* params)
+{
+    uint32_t stack = alloc_pages(THREAD_STACK_ORDER);
+    if (!stack) return;
+    
+    cpu_t* cpu = &cpus[cpu_count++];
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->self = cpu;
+    cpu->id = cpu_count - 1;
+    cpu->apic_id = apic_id;
+    cpu->stack_top = stack + THREAD_STACK_SIZE;
+    params->stack = cpu->stack_top;
+    params->cpu = cpu;
+    
+    // The second STARTUP is only for CPUs that missed the first
+    apic_send_init(apic_id);
+    smp_delay_ns(SMP_INIT_DELAY_NS);
+    for (int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        apic_send_startup(apic_id, SMP_TRAMPOLINE >> 12);
+        smp_delay_ns(SMP_STARTUP_DELAY_NS);
+    }
+    
+    uint64_t start = ktime_get_ns();
+    while (!cpu->online && ktime_get_ns() - start < SMP_ONLINE_TIMEOUT_NS) {
+        smp_poll(this_cpu());
+        asm volatile("pause");
+    }
+    
+    // Every CPU starts from the same parameter block, so one that never
+    // answered must not wake later and take the next CPU's stack and
+    // cpu_t: INIT parks it for good, then its slot and stack are reused.
+    // The CPU goes online under the kernel lock, so holding it here means
+    // INIT cannot catch it halfway, with the lock taken.
+    uint32_t irq = irq_save();
+    if (cpu->online) {
+        irq_restore(irq);
+        return;
+    }
+    apic_send_init(apic_id);
+    smp_delay_ns(SMP_INIT_DELAY_NS);
+    cpu_count--;
+    irq_restore(irq);
+    free_pages(stack, THREAD_STACK_ORDER);
+}
+
+// After sched_init, so every CPU that comes up has threads to run.
+// "nosmp" on the command line keeps to the boot CPU.
+void smp_init(void)
+{
+    if (kernel_boot_option("nosmp")) return;
+    
+    apic_info_t info;
+    apic_get_info(&info);
+    if (!info.enabled || info.cpu_count < 2) return;
+    cpus[0].apic_id = info.bsp_id;
+    
+    memcpy((void*)SMP_TRAMPOLINE, smp_trampoline, smp_trampoline_end - smp_trampoline);
+    volatile trampoline_params_t* params =
+        (volatile trampoline_params_t*)(SMP_TRAMPOLINE + (smp_trampoline_params - smp_trampoline));
+    uint32_t cr;
+    asm volatile("mov %%cr0, %0" : "=r"(cr));
+    params->cr0 = cr;
+    asm volatile("mov %%cr3, %0" : "=r"(cr));
+    params->cr3 = cr;
+    asm volatile("mov %%cr4, %0" : "=r"(cr));
+    params->cr4 = cr;
+    
+    for (uint32_t i = 0; i < info.cpu_count && cpu_count < SMP_MAX_CPUS; i++) {
+        if (info.cpu_apic_ids[i] == info.bsp_id) continue;
+        smp_start_cpu(info.cpu_apic_ids[i], params);
+    }
+}
+
+uint32_t smp_cpu_count(void)
+{
+    return cpu_count;
+}
+
+cpu_t* smp_cpu(uint32_t index)
+{
+    return index < cpu_count ? &cpus[index] : NULL;
+}
+
+// Make cpu look at need_resched: the interrupt returns through sched_irq_exit
+void smp_send_reschedule(cpu_t* cpu)
+{
+    if (cpu == this_cpu() || !cpu->online) return;
+    
+    apic_send_ipi(cpu->apic_id, APIC_RESCHEDULE_VECTOR);
+    smp_stats.ipis++;
+}
+
+// Page tables changed: have every other CPU drop its whole TLB, and wait
+// until they all have. Call after the change, with the kernel lock held or
+// not.
+void smp_tlb_shootdown(void)
+{
+    if (smp_stats.online < 2) return;
+    
+    uint32_t irq = irq_save();
+    cpu_t* self = this_cpu();
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        cpu_t* cpu = &cpus[i];
+        if (cpu == self || !cpu->online) continue;
+        cpu->tlb_flush = true;
+        apic_send_ipi(cpu->apic_id, APIC_TLB_VECTOR);
+        smp_stats.ipis++;
+    }
+    for (uint32_t i = 0; i < cpu_count; i++) {
+        while (cpus[i].tlb_flush) {
+            asm volatile("pause");
+        }
+    }
+    smp_stats.tlb_shootdowns++;
+    irq_restore(irq);
+}
+
+// TLB shootdown interrupt; usually answered already while taking the lock
+void smp_tlb_handle(void)
+{
+    smp_poll(this_cpu());
+}
+
+void smp_get_stats(smp_stats_t* stats)
+{
+    uint32_t irq = irq_save();
+    *stats = smp_stats;
+    irq_restore(irq);
+}
@@ -0,0 +1,74 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gdt.h"
+
+#define SMP_MAX_CPUS 16
+
+struct thread;
+
+// Per-CPU data; every CPU's gs segment is based at its own cpu_t
+typedef struct cpu {
+    struct cpu* self;           // At gs:0, so this_cpu() is a single load
+    uint32_t id;                // 0 is the boot CPU
+    uint8_t apic_id;
+    volatile bool online;
+    uint32_t lock_depth;        // irq_save nesting, i.e. kernel lock holds
+    struct thread* thread;      // Running on this CPU
+    struct thread* idle;        // Runs when nothing else can; never queued
+    volatile bool need_resched;
+    volatile bool tlb_flush;    // Another CPU changed the page tables
+    bool tick_stopped;
+    uint64_t start_tsc;
+    uint64_t idle_since;
+    uint64_t idle_cycles;
+    uint32_t stack_top;         // Stack the CPU started on; 0 on the boot CPU
+    struct gdt_entry gdt[GDT_ENTRIES];
+    struct gdt_ptr gdt_ptr;
+    struct tss_entry tss;
+} cpu_t;
+
+typedef struct {
+    uint32_t online;
+    uint32_t lock_contended;    // Kernel lock acquisitions that had to spin
+    uint32_t ipis;
+    uint32_t tlb_shootdowns;
+} smp_stats_t;
+
+static inline cpu_t* this_cpu(void)
+{
+    cpu_t* cpu;
+    asm volatile("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline uint32_t smp_processor_id(void)
+{
+    return this_cpu()->id;
+}
+
+cpu_t* smp_boot_cpu(void);
+void smp_init(void);
+uint32_t smp_cpu_count(void);
+cpu_t* smp_cpu(uint32_t index);
+void smp_send_reschedule(cpu_t* cpu);
+void smp_tlb_shootdown(void);
+void smp_tlb_handle(void);
+void smp_get_stats(smp_stats_t* stats);
+
+// The lock irq_save and irq_restore take on top of masking interrupts
+void kernel_lock(void);
+void kernel_unlock(void);
+
+// A lock for data that must not wait for the kernel lock; hold it with
+// interrupts disabled on this CPU, and take nothing else while holding it
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+
+#endif
@@ -0,0 +1,75 @@
+; Application processor startup. smp_init copies everything from
+; smp_trampoline to smp_trampoline_end to SMP_TRAMPOLINE, fills in the
+; parameters at the end, and sends a STARTUP IPI that starts the CPU there
+; in real mode. The copy runs at a different address than it was linked
+; at, so addresses inside it are computed from SMP_TRAMPOLINE.
+
+SMP_TRAMPOLINE equ 0x8000       ; Page aligned, below 1 MiB; must match smp.c
+
+%define TRAMPOLINE_ADDR(label) (SMP_TRAMPOLINE + (label - smp_trampoline))
+
+section .text
+global smp_trampoline
+global smp_trampoline_params
+global smp_trampoline_end
+extern smp_ap_entry
+
+bits 16
+smp_trampoline:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMPOLINE_ADDR(trampoline_gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                   ; Protection enable
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE_ADDR(trampoline_protected)
+
+bits 32
+trampoline_protected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    
+    ; Paging exactly as the boot CPU has it; low memory is identity mapped,
+    ; so the next instruction is still here
+    mov eax, [TRAMPOLINE_ADDR(trampoline_cr4)]
+    mov cr4, eax
+    mov eax, [TRAMPOLINE_ADDR(trampoline_cr3)]
+    mov cr3, eax
+    mov eax, [TRAMPOLINE_ADDR(trampoline_cr0)]
+    mov cr0, eax
+    
+    ; smp_ap_entry(cpu) on the stack smp_init allocated; it never returns
+    mov esp, [TRAMPOLINE_ADDR(trampoline_stack)]
+    push dword [TRAMPOLINE_ADDR(trampoline_cpu)]
+    mov eax, smp_ap_entry
+    call eax
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat code and data, just until smp_ap_entry loads the CPU's own GDT
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdt_ptr:
+    dw trampoline_gdt_ptr - trampoline_gdt - 1
+    dd TRAMPOLINE_ADDR(trampoline_gdt)
+
+; trampoline_params_t in smp.c
+align 4
+smp_trampoline_params:
+trampoline_cr0:     dd 0
+trampoline_cr3:     dd 0
+trampoline_cr4:     dd 0
+trampoline_stack:   dd 0
+trampoline_cpu:     dd 0
+smp_trampoline_end:
@@ -0,0 +1,21 @@
+global switch_context
+
+; void switch_context(uint32_t* old_esp, uint32_t new_esp)
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer through old_esp and resumes the thread whose stack is new_esp.
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
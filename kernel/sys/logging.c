@@ -2,8 +2,12 @@
 #include "../kernel.h"
 #include "../lib/lib.h"
 #include "../terminal/terminal.h"
+#include "../memory/memory.h"
+#include "../cpu.h"
 
 #define MAX_LOG_ENTRIES 256
+#define LOG_CHUNK_ENTRIES 16
+#define LOG_CHUNKS (MAX_LOG_ENTRIES / LOG_CHUNK_ENTRIES)
 #define MAX_LOG_MESSAGE 128
 #define MAX_LOG_COMPONENT 32
 
@@ -14,28 +18,77 @@ typedef struct {
     uint32_t timestamp;
 } log_entry_t;
 
-static log_entry_t log_buffer[MAX_LOG_ENTRIES];
+// The ring buffer is split into heap-allocated chunks, allocated on first
+// use and handed back by the shrinker under memory pressure. The ring only
+// changes inside irq_save, since the shrinker runs on any CPU's idle thread.
+static log_entry_t* log_chunks[LOG_CHUNKS];
 static uint32_t log_count_val = 0;
 static uint32_t log_index = 0;
+static uint32_t log_dropped = 0;
 static bool logging_enabled = true;
 
 static const char* level_names[] = {
     "DEBUG", "INFO", "WARN", "ERROR", "CRIT"
 };
 
+static log_entry_t* log_slot(uint32_t index, bool create)
+{
+    log_entry_t** chunk = &log_chunks[index / LOG_CHUNK_ENTRIES];
+    if (!*chunk) {
+        if (!create) return NULL;
+        *chunk = (log_entry_t*)kmalloc(sizeof(log_entry_t) * LOG_CHUNK_ENTRIES);
+        if (!*chunk) return NULL;
+        memset(*chunk, 0, sizeof(log_entry_t) * LOG_CHUNK_ENTRIES);
+    }
+    return &(*chunk)[index % LOG_CHUNK_ENTRIES];
+}
+
+// Shrinker: drop the oldest entries a chunk at a time until about target
+// pages' worth of chunks are freed. The chunk holding the newest entry
+// always stays; once the ring has wrapped, the older entries sharing it go
+// first without freeing anything, so the entries left stay contiguous.
+static void log_shrink(uint32_t target)
+{
+    uint32_t irq = irq_save();
+    uint32_t newest = (log_index + MAX_LOG_ENTRIES - 1) % MAX_LOG_ENTRIES;
+    uint32_t keep = newest / LOG_CHUNK_ENTRIES;
+    uint32_t freed = 0;     // Bytes
+    
+    while (log_count_val > 0 && freed / PAGE_SIZE < target) {
+        uint32_t oldest = (log_index + MAX_LOG_ENTRIES - log_count_val) % MAX_LOG_ENTRIES;
+        uint32_t chunk = oldest / LOG_CHUNK_ENTRIES;
+        uint32_t entries = LOG_CHUNK_ENTRIES - oldest % LOG_CHUNK_ENTRIES;
+        if (entries >= log_count_val) break;
+        
+        log_count_val -= entries;
+        log_dropped += entries;
+        if (chunk != keep && log_chunks[chunk]) {
+            kfree(log_chunks[chunk]);
+            log_chunks[chunk] = NULL;
+            freed += sizeof(log_entry_t) * LOG_CHUNK_ENTRIES;
+        }
+    }
+    irq_restore(irq);
+}
+
 void log_init(void)
 {
-    memset(log_buffer, 0, sizeof(log_buffer));
-    log_count_val = 0;
-    log_index = 0;
+    log_clear();
     logging_enabled = true;
+    shrinker_register("log", log_shrink, 30);
 }
 
 void log_message(int level, const char* component, const char* message)
 {
     if (!logging_enabled || !message) return;
     
-    log_entry_t* entry = &log_buffer[log_index];
+    uint32_t irq = irq_save();
+    log_entry_t* entry = log_slot(log_index, true);
+    if (!entry) {
+        log_dropped++;
+        irq_restore(irq);
+        return;
+    }
     entry->level = level;
     
     if (component) {
@@ -55,6 +108,7 @@ void log_message(int level, const char* component, const char* message)
     if (log_count_val < MAX_LOG_ENTRIES) {
         log_count_val++;
     }
+    irq_restore(irq);
 }
 
 void log_debug(const char* component, const char* message)
@@ -88,14 +142,30 @@ void log_print_all(void)
     terminal_writeln("=== System Log ===");
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
     
-    uint32_t start = (log_count_val >= MAX_LOG_ENTRIES) ? log_index : 0;
+    uint32_t irq = irq_save();
     uint32_t count = (log_count_val < MAX_LOG_ENTRIES) ? log_count_val : MAX_LOG_ENTRIES;
+    uint32_t start = (log_index + MAX_LOG_ENTRIES - count) % MAX_LOG_ENTRIES;
+    uint32_t dropped = log_dropped;
+    irq_restore(irq);
+    
+    if (dropped) {
+        terminal_setcolor(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
+        printf("(%u older entries dropped to free memory)\n", dropped);
+    }
     
     for (uint32_t i = 0; i < count; i++) {
+        // Print from a copy: the shrinker may free the chunk meanwhile
         uint32_t idx = (start + i) % MAX_LOG_ENTRIES;
-        log_entry_t* entry = &log_buffer[idx];
+        log_entry_t copy;
+        irq = irq_save();
+        log_entry_t* entry = log_slot(idx, false);
+        if (entry) {
+            copy = *entry;
+            entry = &copy;
+        }
+        irq_restore(irq);
         
-        if (entry->message[0] != '\0') {
+        if (entry && entry->message[0] != '\0') {
             // Set color based on level
             switch (entry->level) {
                 case LOG_DEBUG:
@@ -131,9 +201,17 @@ void log_print_all(void)
 
 void log_clear(void)
 {
-    memset(log_buffer, 0, sizeof(log_buffer));
+    uint32_t irq = irq_save();
+    for (uint32_t i = 0; i < LOG_CHUNKS; i++) {
+        if (log_chunks[i]) {
+            kfree(log_chunks[i]);
+            log_chunks[i] = NULL;
+        }
+    }
     log_count_val = 0;
     log_index = 0;
+    log_dropped = 0;
+    irq_restore(irq);
 }
 
 uint32_t log_count(void)
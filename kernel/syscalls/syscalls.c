@@ -60,13 +60,15 @@ int sys_getpid(void)
 
 int sys_sleep(uint32_t seconds)
 {
-    extern uint32_t pit_get_milliseconds(void);
-    uint32_t start = pit_get_milliseconds();
-    uint32_t target = start + (seconds * 1000);
-    
-    while (pit_get_milliseconds() < target) {
-        asm volatile("pause");
-    }
+    extern void pit_delay_ms(uint32_t milliseconds);
+    pit_delay_ms(seconds * 1000);
+    return 0;
+}
+
+int sys_gettime(timeval_t* tv)
+{
+    if (!tv) return -1;
+    gettimeofday(tv);
     return 0;
 }
 
@@ -112,6 +114,9 @@ void syscall_handler(uint32_t syscall_num, uint32_t arg1, uint32_t arg2, uint32_
         case SYS_GETPID:
             result = sys_getpid();
             break;
+        case SYS_GETTIME:
+            result = sys_gettime((timeval_t*)arg1);
+            break;
         case SYS_SLEEP:
             result = sys_sleep(arg1);
             break;
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "../time/time.h"
 
 // System call numbers
 #define SYS_EXIT        1
@@ -34,6 +35,7 @@ int sys_write(int fd, const char* buf, size_t count);
 int sys_read(int fd, char* buf, size_t count);
 int sys_getpid(void);
 int sys_sleep(uint32_t seconds);
+int sys_gettime(timeval_t* tv);
 int sys_getenv(const char* name, char* value, size_t max_len);
 int sys_setenv(const char* name, const char* value);
 
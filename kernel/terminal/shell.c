@@ -4,6 +4,11 @@
 #include "../drivers/drivers.h"
 #include "../fs/fs.h"
 #include "../sys/logging.h"
+#include "../memory/memory.h"
+#include "../sched/sched.h"
+#include "../cpu.h"
+#include "../time/time.h"
+#include "../smp.h"
 
 #define SHELL_MAX_INPUT 256
 #define SHELL_MAX_ARGS 16
@@ -39,6 +44,7 @@ static int shell_exit_code = 0;
 static bool shell_exit_flag = false;
 
 static void shell_execute_command(const char* command);
+static void shell_run_command(const char* command);
 static void shell_update_prompt(void);
 void shell_setenv(const char* name, const char* value);
 
@@ -138,6 +144,22 @@ void shell_process_input(char c)
     }
 }
 
+// Write text left-aligned in a column of the given width
+static void shell_write_column(const char* text, size_t width)
+{
+    terminal_writestring(text);
+    for (size_t i = strlen(text); i < width; i++) {
+        terminal_writechar(' ');
+    }
+}
+
+static void shell_write_number_column(uint32_t value, size_t width)
+{
+    char num_str[16];
+    itoa(value, num_str, 10);
+    shell_write_column(num_str, width);
+}
+
 static void cmd_help(void)
 {
     terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
@@ -203,7 +225,17 @@ static void cmd_help(void)
     terminal_writeln("    banner    - Show ASCII art banner");
     terminal_writeln("    about     - About huggingOS");
     terminal_writeln("    history   - Show command history");
-    terminal_writeln("    mem       - Show memory information");
+    terminal_writeln("    mem       - Show memory information (maps: mapped regions)");
+    terminal_writeln("    slabinfo  - Show slab allocator caches");
+    terminal_writeln("    buddyinfo - Show free page blocks per order");
+    terminal_writeln("    vmstat    - Show page fault and zero pool statistics");
+    terminal_writeln("    memstat   - Per-caller heap usage (on/off/reset/dump)");
+    terminal_writeln("    fbbench   - Framebuffer clear speed, uncached vs WC");
+    terminal_writeln("    tlbbench  - TLB refill cost after CR3 reloads, global vs not");
+    terminal_writeln("    reclaim   - Memory pressure and shrinkers (now/wm)");
+    terminal_writeln("    sched     - Threads, run queues, slice/prio (cmd & runs in background)");
+    terminal_writeln("    clocksource - Clock sources, tick devices and read cost");
+    terminal_writeln("    apic      - Interrupt controllers and CPUs");
     terminal_writeln("    env       - Show environment variables");
     terminal_writeln("    export    - Set environment variable");
     terminal_writeln("    alias     - Create command alias");
@@ -297,6 +329,14 @@ static void cmd_info(void)
     terminal_writestring(minute_str);
     terminal_writeln("m");
     
+    sched_stats_t stats;
+    sched_get_stats(&stats);
+    terminal_setcolor(VGA_COLOR_LIGHT_MAGENTA, VGA_COLOR_BLACK);
+    terminal_writestring("  CPU Usage:      ");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    printf("%u%% (last second), %u%% since boot, idle via %s\n", stats.load_percent, stats.busy_percent,
+           stats.mwait ? "MWAIT" : "HLT");
+    
     terminal_setcolor(VGA_COLOR_LIGHT_MAGENTA, VGA_COLOR_BLACK);
     terminal_writestring("  Status:         ");
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
@@ -483,10 +523,12 @@ static void cmd_about(void)
 
 static void cmd_clock(void)
 {
-    // Get real time from RTC
-    uint8_t hour = rtc_get_hour();
-    uint8_t minute = rtc_get_minute();
-    uint8_t second = rtc_get_second();
+    // One snapshot of the wall clock, so the fields agree with each other
+    rtc_time_t time;
+    rtc_get_time(&time);
+    uint8_t hour = time.hour;
+    uint8_t minute = time.minute;
+    uint8_t second = time.second;
     
     // Format time display
     char hour_str[4];
@@ -515,10 +557,12 @@ static void cmd_clock(void)
 
 static void cmd_calendar(void)
 {
-    // Get current date from RTC
-    uint16_t year = rtc_get_full_year();
-    uint8_t month = rtc_get_month();
-    uint8_t day = rtc_get_day();
+    // Get current date from the wall clock
+    rtc_time_t time;
+    rtc_get_time(&time);
+    uint16_t year = 2000 + time.year;
+    uint8_t month = time.month;
+    uint8_t day = time.day;
     
     // Month names
     const char* month_names[] = {
@@ -599,10 +643,10 @@ static void cmd_calendar(void)
 
 static void cmd_date(void)
 {
-    // Get real date and time from RTC
+    // Get real date and time from the wall clock
     rtc_time_t time;
     rtc_get_time(&time);
-    uint16_t full_year = rtc_get_full_year();
+    uint16_t full_year = 2000 + time.year;
     
     // Month names
     const char* month_names[] = {
@@ -660,6 +704,14 @@ static void cmd_date(void)
     terminal_writestring(":");
     if (time.second < 10) terminal_writestring("0");
     terminal_writeln(second_str);
+    
+    timeval_t now;
+    gettimeofday(&now);
+    rtc_stats_t rtc;
+    rtc_get_stats(&rtc);
+    printf("Epoch: %u s %u us\n", now.tv_sec, now.tv_usec);
+    printf("RTC sync: %u on IRQ8, %u polled, last correction %d us\n",
+           rtc.irq_syncs, rtc.polled_syncs, rtc.last_offset_us);
     terminal_writeln("");
     terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
 }
@@ -702,7 +754,10 @@ static void cmd_timer(const char* args)
             last_second = current_second;
         }
         
-        asm volatile("pause");
+        // Sleep until the next whole second, or the end
+        uint32_t next_tick = start_ticks + (elapsed_ms / 1000 + 1) * 1000;
+        if (next_tick > target_ticks) next_tick = target_ticks;
+        pit_delay_ms(next_tick - pit_get_milliseconds());
     }
     
     terminal_writeln("");
@@ -754,6 +809,23 @@ static void cmd_uptime(void)
     terminal_writestring(":");
     if (seconds < 10) terminal_writestring("0");
     terminal_writeln(second_str);
+    
+    sched_stats_t stats;
+    sched_get_stats(&stats);
+    printf("CPU:    %u%% busy over the last second, %u%% since boot\n", stats.load_percent,
+           stats.busy_percent);
+    
+    // Monotonic clock with microseconds, zero-padded by hand
+    uint64_t now_ns = ktime_get_ns();
+    uint32_t now_s = (uint32_t)div_u64(now_ns, NSEC_PER_SEC);
+    uint32_t now_us = (uint32_t)div_u64(now_ns - (uint64_t)now_s * NSEC_PER_SEC, 1000);
+    printf("Clock:  %u.", now_s);
+    for (uint32_t digit = 100000; digit > 1 && now_us < digit; digit /= 10) {
+        terminal_writestring("0");
+    }
+    clocksource_t* cs = clocksource_current();
+    printf("%u s monotonic, %s at %u kHz\n", now_us, cs ? cs->name : "none",
+           cs ? (uint32_t)div_u64(cs->hz, 1000) : 0);
     terminal_writeln("");
     terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
 }
@@ -1207,8 +1279,64 @@ static void cmd_fortune(void)
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
 }
 
-static void cmd_mem(void)
+// Zero-padded 8-digit hex; itoa is signed and printf does not pad
+static void shell_format_hex(uint32_t value, char* buffer)
+{
+    const char* digits = "0123456789abcdef";
+    for (int i = 7; i >= 0; i--) {
+        buffer[i] = digits[value & 0xF];
+        value >>= 4;
+    }
+    buffer[8] = '\0';
+}
+
+// One line per region of the current address space, lowest address first
+static void mem_maps(void)
 {
+    address_space_t* space = vma_current_space();
+    if (!space) {
+        terminal_writeln("mem: no address space");
+        return;
+    }
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    printf("=== Address space '%s': %u regions, %u KB ===\n", space->name, space->vma_count,
+           space->mapped_bytes / 1024);
+    terminal_writeln("Start     End       Size KB   Flags  Name");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    for (vma_t* vma = vma_first(space); vma; vma = vma_next(vma)) {
+        char flags[7];
+        flags[0] = (vma->flags & VMA_READ) ? 'r' : '-';
+        flags[1] = (vma->flags & VMA_WRITE) ? 'w' : '-';
+        flags[2] = (vma->flags & VMA_USER) ? 'u' : '-';
+        flags[3] = (vma->flags & VMA_DEMAND) ? 'd' : '-';
+        flags[4] = (vma->flags & VMA_MMIO) ? 'm' : '-';
+        flags[5] = ' ';
+        flags[6] = '\0';
+        
+        char start_str[9], end_str[9];
+        shell_format_hex(vma->start, start_str);
+        shell_format_hex(vma->end, end_str);
+        shell_write_column(start_str, 10);
+        shell_write_column(end_str, 10);
+        shell_write_number_column((vma->end - vma->start) / 1024, 10);
+        shell_write_column(flags, 7);
+        terminal_writeln(vma->name);
+    }
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_mem(const char* args)
+{
+    if (args && strcmp(args, "maps") == 0) {
+        mem_maps();
+        return;
+    } else if (args && strlen(args) > 0) {
+        terminal_writeln("Usage: mem [maps]");
+        return;
+    }
+    
     extern uint32_t get_total_memory(void);
     extern uint32_t get_free_memory(void);
     
@@ -1238,6 +1366,579 @@ static void cmd_mem(void)
     terminal_writestring(free_str);
     terminal_writeln(" MB");
     
+    char frames_str[32];
+    terminal_writestring("Free Frames:  ");
+    itoa(frame_get_free_count(), frames_str, 10);
+    terminal_writestring(frames_str);
+    terminal_writestring(" of ");
+    itoa(frame_get_usable_count(), frames_str, 10);
+    terminal_writestring(frames_str);
+    terminal_writeln(" (4 KB each)");
+    
+    heap_stats_t heap;
+    heap_get_stats(&heap);
+    
+    char size_str[32], count_str[32];
+    terminal_writeln("");
+    terminal_writestring("Heap Size:    ");
+    itoa(heap.heap_size / 1024, size_str, 10);
+    terminal_writestring(size_str);
+    terminal_writeln(" KB");
+    
+    terminal_writestring("Heap Used:    ");
+    itoa(heap.used_bytes / 1024, size_str, 10);
+    itoa(heap.alloc_count, count_str, 10);
+    terminal_writestring(size_str);
+    terminal_writestring(" KB in ");
+    terminal_writestring(count_str);
+    terminal_writeln(" blocks");
+    
+    terminal_writestring("Heap Free:    ");
+    itoa(heap.free_bytes / 1024, size_str, 10);
+    itoa(heap.hole_count, count_str, 10);
+    terminal_writestring(size_str);
+    terminal_writestring(" KB in ");
+    terminal_writestring(count_str);
+    terminal_writeln(" holes");
+    
+    paging_info_t paging;
+    paging_get_info(&paging);
+    
+    terminal_writeln("");
+    terminal_writestring("Identity Map: ");
+    itoa(paging.identity_bytes / (1024 * 1024), size_str, 10);
+    terminal_writestring(size_str);
+    if (paging.pse) {
+        itoa(paging.large_pages, count_str, 10);
+        terminal_writestring(" MB in ");
+        terminal_writestring(count_str);
+        terminal_writeln(" x 4 MB pages");
+    } else {
+        terminal_writeln(" MB in 4 KB pages (no PSE)");
+    }
+    terminal_writestring("Global Pages: ");
+    terminal_writeln(paging.pge ? "yes (kernel mappings survive CR3 reloads)" : "no (CPU lacks PGE)");
+    
+    terminal_writestring("Page Tables:  ");
+    itoa(paging.page_tables, count_str, 10);
+    terminal_writestring(count_str);
+    terminal_writestring(", ");
+    itoa(paging.mapped_pages, count_str, 10);
+    terminal_writestring(count_str);
+    terminal_writeln(" pages mapped");
+    
+    dma_stats_t dma;
+    dma_get_stats(&dma);
+    
+    terminal_writestring("DMA Buffers:  ");
+    itoa(dma.allocations - dma.frees, count_str, 10);
+    terminal_writestring(count_str);
+    terminal_writestring(", ");
+    itoa(dma.pages_in_use, count_str, 10);
+    terminal_writestring(count_str);
+    terminal_writestring(" pages (");
+    itoa(dma.isa_pages_in_use, count_str, 10);
+    terminal_writestring(count_str);
+    terminal_writeln(" below 16 MB)");
+    
+    terminal_writeln("");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_slabinfo(void)
+{
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Slab Caches ===");
+    terminal_writeln("Name            ObjSize InUse  Total  Slabs  SizeKB WasteKB");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    uint32_t total_bytes = 0;
+    uint32_t total_waste = 0;
+    for (kmem_cache_t* cache = kmem_cache_first(); cache; cache = cache->next) {
+        kmem_cache_stats_t stats;
+        kmem_cache_get_stats(cache, &stats);
+        total_bytes += stats.bytes_total;
+        total_waste += stats.bytes_wasted;
+        
+        shell_write_column(cache->name, 16);
+        shell_write_number_column(cache->object_size, 8);
+        shell_write_number_column(stats.objects_in_use, 7);
+        shell_write_number_column(stats.objects_total, 7);
+        shell_write_number_column(stats.slabs, 7);
+        shell_write_number_column(stats.bytes_total / 1024, 7);
+        char waste_str[16];
+        itoa(stats.bytes_wasted / 1024, waste_str, 10);
+        terminal_writeln(waste_str);
+    }
+    
+    char total_str[16], waste_str[16];
+    itoa(total_bytes / 1024, total_str, 10);
+    itoa(total_waste / 1024, waste_str, 10);
+    terminal_writestring("Total: ");
+    terminal_writestring(total_str);
+    terminal_writestring(" KB in slabs, ");
+    terminal_writestring(waste_str);
+    terminal_writeln(" KB unused");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_buddyinfo(void)
+{
+    buddy_info_t info;
+    buddy_get_info(&info);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Buddy Allocator ===");
+    terminal_writeln("Order  BlockKB  BuddyFree  Available");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    for (uint32_t order = 0; order <= BUDDY_MAX_ORDER; order++) {
+        shell_write_number_column(order, 7);
+        shell_write_number_column((PAGE_SIZE << order) / 1024, 9);
+        shell_write_number_column(info.free_blocks[order], 11);
+        char avail_str[16];
+        itoa(info.available_blocks[order], avail_str, 10);
+        terminal_writeln(avail_str);
+    }
+    
+    // Fraction of free memory that cannot be used for the largest blocks
+    uint32_t free_pages = info.available_blocks[0];
+    uint32_t max_pages = info.available_blocks[BUDDY_MAX_ORDER] << BUDDY_MAX_ORDER;
+    char pages_str[16], frag_str[16];
+    itoa(info.free_pages, pages_str, 10);
+    itoa(free_pages ? 100 - (max_pages * 100) / free_pages : 0, frag_str, 10);
+    terminal_writestring("Pages on buddy lists: ");
+    terminal_writeln(pages_str);
+    terminal_writestring("Fragmentation (order ");
+    char order_str[8];
+    itoa(BUDDY_MAX_ORDER, order_str, 10);
+    terminal_writestring(order_str);
+    terminal_writestring("): ");
+    terminal_writestring(frag_str);
+    terminal_writeln("%");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_vmstat(void)
+{
+    page_fault_stats_t faults;
+    paging_get_fault_stats(&faults);
+    paging_info_t paging;
+    paging_get_info(&paging);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Virtual Memory ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    char num_str[16];
+    terminal_writestring("Mapped pages:      ");
+    itoa(paging.mapped_pages, num_str, 10);
+    terminal_writeln(num_str);
+    
+    terminal_writestring("Minor faults:      ");
+    itoa(faults.minor_faults, num_str, 10);
+    terminal_writeln(num_str);
+    
+    uint32_t avg = faults.minor_faults ? (uint32_t)div_u64(faults.total_cycles, faults.minor_faults) : 0;
+    terminal_writestring("Avg fault cycles:  ");
+    itoa(avg, num_str, 10);
+    terminal_writeln(num_str);
+    
+    terminal_writestring("Max fault cycles:  ");
+    itoa(faults.max_cycles, num_str, 10);
+    terminal_writeln(num_str);
+    
+    // itoa is signed, so heap addresses go through printf
+    printf("Last fault:        %x\n", faults.last_address);
+    
+    zero_pool_stats_t pool;
+    zero_pool_get_stats(&pool);
+    
+    terminal_writeln("");
+    terminal_writestring("Zero pool:         ");
+    itoa(pool.depth, num_str, 10);
+    terminal_writestring(num_str);
+    terminal_writestring(" / ");
+    itoa(pool.capacity, num_str, 10);
+    terminal_writestring(num_str);
+    terminal_writeln(" pages");
+    
+    terminal_writestring("Pool hits/misses:  ");
+    itoa(pool.hits, num_str, 10);
+    terminal_writestring(num_str);
+    terminal_writestring(" / ");
+    itoa(pool.misses, num_str, 10);
+    terminal_writeln(num_str);
+    
+    terminal_writestring("Zeroed when idle:  ");
+    itoa(pool.idle_zeroed, num_str, 10);
+    terminal_writeln(num_str);
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+// One CSV line per call site: caller,live,peak,allocs,frees,<histogram buckets>
+static void memstat_dump(void)
+{
+    printf("caller,live_bytes,peak_bytes,allocs,frees");
+    for (uint32_t b = 0; b < HEAP_TRACK_BUCKETS; b++) {
+        printf(",h%u", b);
+    }
+    printf("\n");
+    
+    heap_site_t site;
+    for (uint32_t i = 0; i < HEAP_TRACK_SITES; i++) {
+        if (!heap_track_get_site(i, &site)) continue;
+        printf("%x,%u,%u,%u,%u", site.caller, site.live_bytes, site.peak_bytes, site.allocs, site.frees);
+        for (uint32_t b = 0; b < HEAP_TRACK_BUCKETS; b++) {
+            printf(",%u", site.histogram[b]);
+        }
+        printf("\n");
+    }
+}
+
+static void cmd_memstat(const char* args)
+{
+    if (args && strcmp(args, "on") == 0) {
+        heap_track_enable(true);
+        terminal_writeln("Heap allocation tracking enabled");
+        return;
+    } else if (args && strcmp(args, "off") == 0) {
+        heap_track_enable(false);
+        terminal_writeln("Heap allocation tracking disabled");
+        return;
+    } else if (args && strcmp(args, "reset") == 0) {
+        heap_track_reset();
+        terminal_writeln("Heap allocation statistics cleared");
+        return;
+    } else if (args && strcmp(args, "dump") == 0) {
+        memstat_dump();
+        return;
+    } else if (args && strlen(args) > 0) {
+        terminal_writeln("Usage: memstat [on|off|reset|dump]");
+        return;
+    }
+    
+    heap_track_summary_t summary;
+    heap_track_get_summary(&summary);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writestring("=== Heap Allocations by Caller (tracking ");
+    terminal_writestring(summary.enabled ? "on" : "off");
+    terminal_writeln(") ===");
+    terminal_writeln("Caller      LiveB     PeakB     Allocs  Frees");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    // Largest live users first; the table is small, so a selection pass is enough
+    bool shown[HEAP_TRACK_SITES];
+    memset(shown, 0, sizeof(shown));
+    for (uint32_t row = 0; row < 16; row++) {
+        int32_t best = -1;
+        heap_site_t site, best_site;
+        for (uint32_t i = 0; i < HEAP_TRACK_SITES; i++) {
+            if (shown[i] || !heap_track_get_site(i, &site)) continue;
+            if (best < 0 || site.live_bytes > best_site.live_bytes) {
+                best = (int32_t)i;
+                best_site = site;
+            }
+        }
+        if (best < 0) break;
+        shown[best] = true;
+        
+        printf("%x  ", best_site.caller);
+        shell_write_number_column(best_site.live_bytes, 10);
+        shell_write_number_column(best_site.peak_bytes, 10);
+        shell_write_number_column(best_site.allocs, 8);
+        char frees_str[16];
+        itoa(best_site.frees, frees_str, 10);
+        terminal_writeln(frees_str);
+    }
+    
+    printf("Tracked: %u bytes live, %u peak, %u sites, %u dropped\n",
+           summary.live_bytes, summary.peak_bytes, summary.sites, summary.dropped);
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_fbbench(void)
+{
+    vesa_bench_t bench;
+    if (!vesa_benchmark(&bench)) {
+        terminal_writeln("fbbench: no linear framebuffer (boot in a 32-bit graphics mode)");
+        return;
+    }
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Framebuffer Clear Benchmark ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    printf("Write-combining via: %s\n", pat_wc_method());
+    printf("Bytes per clear:     %u\n", bench.bytes);
+    printf("Uncached:            %u cycles/clear\n", bench.uc_cycles);
+    printf("Write-combining:     %u cycles/clear\n", bench.wc_cycles);
+    
+    if (bench.wc_cycles) {
+        uint32_t speedup = (uint32_t)div_u64((uint64_t)bench.uc_cycles * 10, bench.wc_cycles);
+        printf("Speedup:             %u.%ux\n", speedup / 10, speedup % 10);
+    }
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_tlbbench(void)
+{
+    tlb_bench_t bench;
+    if (!paging_tlb_benchmark(&bench)) {
+        terminal_writeln("tlbbench: CPU has no global pages (PGE) or out of memory");
+        return;
+    }
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== TLB Benchmark (CR3 reload + touch) ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    printf("Pages per round:     %u\n", bench.pages);
+    printf("Global mappings:     %u cycles/round\n", bench.global_cycles);
+    printf("Non-global mappings: %u cycles/round\n", bench.local_cycles);
+    if (bench.local_cycles > bench.global_cycles) {
+        printf("Saved per switch:    %u cycles\n", bench.local_cycles - bench.global_cycles);
+    }
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_reclaim(const char* args)
+{
+    if (args && strcmp(args, "now") == 0) {
+        uint32_t pages = shrink_memory(0xFFFFFFFF);
+        printf("Reclaimed %u pages\n", pages);
+        return;
+    } else if (args && strncmp(args, "wm ", 3) == 0) {
+        char args_copy[64];
+        strncpy(args_copy, args + 3, sizeof(args_copy) - 1);
+        args_copy[sizeof(args_copy) - 1] = '\0';
+        char* low = strtok(args_copy, " ");
+        char* high = low ? strtok(NULL, " ") : NULL;
+        if (!high || atoi(low) <= 0 || atoi(high) < atoi(low)) {
+            terminal_writeln("Usage: reclaim wm <low pages> <high pages>");
+            return;
+        }
+        shrink_set_watermarks((uint32_t)atoi(low), (uint32_t)atoi(high));
+        printf("Watermarks set to %u / %u pages\n", (uint32_t)atoi(low), (uint32_t)atoi(high));
+        return;
+    } else if (args && strlen(args) > 0) {
+        terminal_writeln("Usage: reclaim [now | wm <low> <high>]");
+        return;
+    }
+    
+    shrink_stats_t stats;
+    shrink_get_stats(&stats);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Memory Reclaim ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    printf("Free pages:      %u%s\n", stats.free_pages, stats.pressure ? " (under pressure)" : "");
+    printf("Watermarks:      low %u, high %u\n", stats.low_watermark, stats.high_watermark);
+    printf("Pressure events: %u\n", stats.pressure_events);
+    printf("Reclaim runs:    %u, %u pages reclaimed\n", stats.reclaim_runs, stats.pages_reclaimed);
+    
+    terminal_writeln("");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("Shrinker    Prio  Calls   Pages");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    for (shrinker_t* shrinker = shrinker_first(); shrinker; shrinker = shrinker->next) {
+        shell_write_column(shrinker->name, 12);
+        shell_write_number_column(shrinker->priority, 6);
+        shell_write_number_column(shrinker->calls, 8);
+        char pages_str[16];
+        itoa(shrinker->pages_reclaimed, pages_str, 10);
+        terminal_writeln(pages_str);
+    }
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static const char* thread_state_name(thread_state_t state)
+{
+    switch (state) {
+        case THREAD_READY: return "ready";
+        case THREAD_RUNNING: return "running";
+        case THREAD_BLOCKED: return "blocked";
+        default: return "dead";
+    }
+}
+
+static void cmd_sched(const char* args)
+{
+    if (args && strncmp(args, "slice ", 6) == 0) {
+        int ticks = atoi(args + 6);
+        if (ticks <= 0) {
+            terminal_writeln("Usage: sched slice <ms>");
+            return;
+        }
+        sched_set_slice((uint32_t)ticks);
+        printf("Time slice set to %u ms\n", (uint32_t)ticks);
+        return;
+    } else if (args && strncmp(args, "prio ", 5) == 0) {
+        char args_copy[64];
+        strncpy(args_copy, args + 5, sizeof(args_copy) - 1);
+        args_copy[sizeof(args_copy) - 1] = '\0';
+        char* id_str = strtok(args_copy, " ");
+        char* prio_str = id_str ? strtok(NULL, " ") : NULL;
+        if (!prio_str) {
+            terminal_writeln("Usage: sched prio <id> <0-31>");
+            return;
+        }
+        
+        uint32_t id = (uint32_t)atoi(id_str);
+        bool done = false;
+        uint32_t irq = irq_save();
+        for (thread_t* thread = thread_first(); thread; thread = thread->next) {
+            if (thread->id == id) {
+                done = thread_set_priority(thread, (uint32_t)atoi(prio_str));
+                break;
+            }
+        }
+        irq_restore(irq);
+        terminal_writeln(done ? "Priority changed" : "No such thread or priority out of range");
+        return;
+    } else if (args && strlen(args) > 0) {
+        terminal_writeln("Usage: sched [slice <ms> | prio <id> <0-31>]");
+        return;
+    }
+    
+    sched_stats_t stats;
+    sched_get_stats(&stats);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Scheduler ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    printf("Threads: %u, time slice %u ms\n", stats.threads, stats.slice);
+    printf("Context switches: %u (%u preemptions, %u yields)\n", stats.context_switches,
+           stats.preemptions, stats.yields);
+    
+    smp_stats_t smp;
+    smp_get_stats(&smp);
+    printf("CPUs: %u running threads, kernel lock contended %u times\n", stats.cpus, smp.lock_contended);
+    printf("IPIs: %u sent, %u TLB shootdowns\n", smp.ipis, smp.tlb_shootdowns);
+    printf("Work stealing: %u steals, %u empty victims, %u migrations\n", stats.steals,
+           stats.steal_misses, stats.migrations);
+    
+    // Only the non-empty queues; 0 is the highest priority
+    terminal_writestring("Ready queues:     ");
+    bool any = false;
+    for (uint32_t prio = 0; prio < SCHED_PRIORITIES; prio++) {
+        if (stats.queue_length[prio] == 0) continue;
+        printf("p%u=%u ", prio, stats.queue_length[prio]);
+        any = true;
+    }
+    terminal_writeln(any ? "" : "empty");
+    terminal_writestring("Ready per CPU:    ");
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        printf("cpu%u=%u ", cpu, stats.cpu_queue_length[cpu]);
+    }
+    terminal_writeln("");
+    
+    ktimer_stats_t timers;
+    ktimer_get_stats(&timers);
+    printf("Timers: %u pending, %u fired, %u cascaded\n", timers.pending, timers.fired, timers.cascaded);
+    
+    tick_stats_t tick;
+    tick_get_stats(&tick);
+    clockevent_t* tick_device = clockevent_current();
+    printf("Tick: %s from %s, %u interrupts, stopped %u times in idle\n",
+           tick.tickless ? "tickless" : "periodic", tick_device ? tick_device->name : "none",
+           tick.interrupts, tick.idle_stops);
+    
+    terminal_writeln("");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("ID    Name            Prio  State     CPU  Ticks     Switches");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    // Snapshot first: threads may exit while the table is being printed
+    thread_t rows[16];
+    uint32_t count = 0;
+    uint32_t irq = irq_save();
+    for (thread_t* thread = thread_first(); thread && count < 16; thread = thread->next) {
+        rows[count++] = *thread;
+    }
+    irq_restore(irq);
+    
+    for (uint32_t i = 0; i < count; i++) {
+        shell_write_number_column(rows[i].id, 6);
+        shell_write_column(rows[i].name, 16);
+        shell_write_number_column(rows[i].priority, 6);
+        shell_write_column(thread_state_name(rows[i].state), 10);
+        shell_write_number_column(rows[i].cpu, 5);
+        shell_write_number_column(rows[i].ticks, 10);
+        char switches_str[16];
+        itoa(rows[i].switches, switches_str, 10);
+        terminal_writeln(switches_str);
+    }
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_clocksource(void)
+{
+    clocksource_t* current_cs = clocksource_current();
+    clockevent_t* current_event = clockevent_current();
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Clock Sources ===");
+    terminal_writeln("Name    Rating  kHz         Resolution  Read cost");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    for (clocksource_t* cs = clocksource_first(); cs; cs = cs->next) {
+        char name[16];
+        strcpy(name, cs->name);
+        if (cs == current_cs) strcat(name, " *");
+        shell_write_column(name, 8);
+        shell_write_number_column(cs->rating, 8);
+        shell_write_number_column((uint32_t)div_u64(cs->hz, 1000), 12);
+        
+        uint32_t resolution = (uint32_t)div_u64(NSEC_PER_SEC + cs->hz - 1, (uint32_t)cs->hz);
+        printf("%u ns", resolution);
+        for (uint32_t width = 12; width > 8 && resolution < 1000; width--, resolution *= 10) {
+            terminal_writechar(' ');
+        }
+        printf("%u ns\n", clocksource_bench_ns(cs));
+    }
+    
+    terminal_writeln("");
+    terminal_writestring("Clock events: ");
+    for (clockevent_t* dev = clockevent_first(); dev; dev = dev->next) {
+        printf("%s%s (rating %u) ", dev->name, dev == current_event ? " *" : "", dev->rating);
+    }
+    terminal_writeln("");
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+}
+
+static void cmd_apic(void)
+{
+    apic_info_t info;
+    apic_get_info(&info);
+    
+    terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+    terminal_writeln("=== Interrupt Controller ===");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+    
+    if (!info.enabled) {
+        terminal_writeln("Legacy 8259 PICs (no usable APIC, or apic=off)");
+        terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
+        return;
+    }
+    
+    printf("Local APIC at 0x%x, boot CPU APIC ID %u\n", info.lapic_address, info.bsp_id);
+    printf("I/O APICs: %u with %u pins; 8259 PICs masked\n", info.ioapic_count, info.ioapic_pins);
+    printf("APIC timer: %u kHz\n", info.timer_hz / 1000);
+    terminal_writestring("CPUs: ");
+    for (uint32_t i = 0; i < info.cpu_count; i++) {
+        printf("%u%s", info.cpu_apic_ids[i], info.cpu_apic_ids[i] == info.bsp_id ? "* " : " ");
+    }
+    terminal_writeln("");
+    
+    // APIC IDs of the CPUs that came up and run threads
+    terminal_writestring("Online: ");
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        cpu_t* cpu = smp_cpu(i);
+        if (cpu->online) printf("%u ", cpu->apic_id);
+    }
     terminal_writeln("");
     terminal_setcolor(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
 }
@@ -1624,12 +2325,7 @@ static void cmd_sleep(const char* args)
         return;
     }
     
-    uint32_t start_ticks = pit_get_milliseconds();
-    uint32_t target_ticks = start_ticks + (seconds * 1000);
-    
-    while (pit_get_milliseconds() < target_ticks) {
-        asm volatile("pause");
-    }
+    pit_delay_ms((uint32_t)seconds * 1000);
 }
 
 static void cmd_exit(const char* args)
@@ -1785,7 +2481,7 @@ static void cmd_df(void)
     itoa(used / (1024 * 1024), used_str, 10);
     itoa(free / (1024 * 1024), free_str, 10);
     
-    int use_percent = (used * 100) / total;
+    int use_percent = total ? (int)((used / 1024) * 100 / (total / 1024)) : 0;
     char percent_str[16];
     itoa(use_percent, percent_str, 10);
     
@@ -1923,7 +2619,7 @@ static void cmd_which(const char* args)
         "cat", "touch", "rm", "mv", "cp", "moti", "joke", "fortune", "grep",
         "find", "wc", "head", "tail", "sort", "uname", "sleep", "exit", "env",
         "export", "alias", "unalias", "df", "du", "test", "true", "false",
-        "basename", "dirname", "which", NULL
+        "basename", "dirname", "which", "slabinfo", "buddyinfo", "vmstat", "memstat", "fbbench", "tlbbench", "reclaim", "sched", "clocksource", "apic", NULL
     };
     
     for (int i = 0; builtins[i]; i++) {
@@ -1948,6 +2644,52 @@ static const char* shell_resolve_alias(const char* cmd)
     return NULL;
 }
 
+static void shell_job_thread(void* arg)
+{
+    char* command = (char*)arg;
+    shell_run_command(command);
+    kfree(command);
+}
+
+static void shell_spawn_job(const char* command, size_t len)
+{
+    while (len > 0 && command[len - 1] == ' ') len--;
+    if (len == 0) {
+        terminal_writeln("Usage: <command> &");
+        return;
+    }
+    
+    char* copy = (char*)kmalloc(len + 1);
+    if (!copy) {
+        terminal_writeln("Out of memory");
+        return;
+    }
+    memcpy(copy, command, len);
+    copy[len] = '\0';
+    
+    // Threads are named after the command word
+    char name[THREAD_NAME_LEN];
+    size_t n = 0;
+    while (n < len && n < THREAD_NAME_LEN - 1 && copy[n] != ' ') {
+        name[n] = copy[n];
+        n++;
+    }
+    name[n] = '\0';
+    
+    // A short job may finish and be reaped before its id is read
+    uint32_t irq = irq_save();
+    thread_t* thread = thread_create(name, shell_job_thread, copy);
+    uint32_t id = thread ? thread->id : 0;
+    irq_restore(irq);
+    
+    if (!thread) {
+        kfree(copy);
+        terminal_writeln("Cannot start background job");
+        return;
+    }
+    printf("[%u] %s\n", id, name);
+}
+
 static void shell_execute_command(const char* command)
 {
     if (strlen(command) == 0)
@@ -1969,6 +2711,17 @@ static void shell_execute_command(const char* command)
         shell_history_count++;
     }
     
+    // A trailing '&' runs the command in a background thread
+    size_t len = strlen(command);
+    if (command[len - 1] == '&') {
+        shell_spawn_job(command, len - 1);
+        return;
+    }
+    shell_run_command(command);
+}
+
+static void shell_run_command(const char* command)
+{
     // Parse command and arguments
     char cmd[SHELL_MAX_INPUT];
     char args[SHELL_MAX_INPUT] = {0};
@@ -1999,7 +2752,7 @@ static void shell_execute_command(const char* command)
             strcat(full_cmd, " ");
             strcat(full_cmd, args);
         }
-        shell_execute_command(full_cmd);
+        shell_run_command(full_cmd);
         return;
     }
     
@@ -2043,7 +2796,27 @@ static void shell_execute_command(const char* command)
     } else if (strcmp(cmd, "pwd") == 0) {
         cmd_pwd();
     } else if (strcmp(cmd, "mem") == 0 || strcmp(cmd, "memory") == 0) {
-        cmd_mem();
+        cmd_mem(args);
+    } else if (strcmp(cmd, "slabinfo") == 0) {
+        cmd_slabinfo();
+    } else if (strcmp(cmd, "buddyinfo") == 0) {
+        cmd_buddyinfo();
+    } else if (strcmp(cmd, "vmstat") == 0) {
+        cmd_vmstat();
+    } else if (strcmp(cmd, "memstat") == 0) {
+        cmd_memstat(args);
+    } else if (strcmp(cmd, "fbbench") == 0) {
+        cmd_fbbench();
+    } else if (strcmp(cmd, "tlbbench") == 0) {
+        cmd_tlbbench();
+    } else if (strcmp(cmd, "reclaim") == 0) {
+        cmd_reclaim(args);
+    } else if (strcmp(cmd, "sched") == 0) {
+        cmd_sched(args);
+    } else if (strcmp(cmd, "clocksource") == 0) {
+        cmd_clocksource();
+    } else if (strcmp(cmd, "apic") == 0) {
+        cmd_apic();
     } else if (strcmp(cmd, "ls") == 0) {
         cmd_ls(args);
     } else if (strcmp(cmd, "mkdir") == 0) {
@@ -2,6 +2,7 @@
 #include "../kernel.h"
 #include "../drivers/drivers.h"
 #include "../lib/lib.h"
+#include "../cpu.h"
 
 // Forward declarations
 extern void vga_putchar(char c);
@@ -21,16 +22,21 @@ void terminal_setcolor(uint8_t fg, uint8_t bg)
     vga_setcolor(color);
 }
 
+// The cursor is shared by every CPU; output goes out under the kernel lock
 void terminal_putchar(char c)
 {
     // Just pass through to VGA - it handles all cursor positioning
+    uint32_t irq = irq_save();
     vga_putchar(c);
+    irq_restore(irq);
 }
 
 void terminal_write(const char* data, size_t size)
 {
+    uint32_t irq = irq_save();
     for (size_t i = 0; i < size; i++)
         terminal_putchar(data[i]);
+    irq_restore(irq);
 }
 
 void terminal_writestring(const char* data)
@@ -0,0 +1,263 @@
+#include "time.h"
+#include "../drivers/drivers.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+
+// Monotonic time from the best registered clocksource. The timekeeper keeps
+// a base time and the counter value it was taken at; a reader adds the
+// cycles elapsed since. The tick interrupt moves the base forward so the
+// elapsed part stays small, and bumps a sequence count around the update:
+// readers never lock, they retry if the count was odd or changed.
+
+#define CPUID_EXT_MAX 0x80000000
+#define CPUID_EXT_POWER 0x80000007
+#define CPUID_EDX_INVARIANT_TSC (1u << 8)
+#define TSC_CALIBRATE_MS 50
+#define CLOCKSOURCE_BENCH_READS 1000
+
+typedef struct {
+    clocksource_t* cs;
+    uint64_t base_cycles;
+    uint64_t base_ns;
+    uint64_t base_frac;         // Sub-nanosecond remainder, in 1 >> shift units
+    uint64_t real_offset;       // Wall-clock time at monotonic zero
+} timekeeper_t;
+
+static timekeeper_t tk;
+static volatile uint32_t tk_seq = 0;
+static clocksource_t* clocksource_list = NULL;
+static bool clocksource_forced = false;     // Chosen on the command line
+
+static uint64_t pit_clock_read(void)
+{
+    return pit_read_cycles();
+}
+
+static uint64_t tsc_clock_read(void)
+{
+    return rdtsc();
+}
+
+static clocksource_t pit_clocksource = {
+    .name = "pit",
+    .read = pit_clock_read,
+    .rating = 100,
+    .max_idle_ns = 50 * NSEC_PER_MSEC,
+};
+
+static clocksource_t tsc_clocksource = {
+    .name = "tsc",
+    .read = tsc_clock_read,
+    .rating = 300,
+    .max_idle_ns = NSEC_PER_SEC,
+};
+
+// Largest shift whose multiplier fits 32 bits. With shift at most 32, a
+// second's worth of cycles times mult is about 2^62, so the tick, never
+// stopped for longer than max_idle_ns, keeps the product inside 64 bits.
+void clocksource_set_hz(clocksource_t* cs, uint64_t hz)
+{
+    cs->hz = hz;
+    
+    // div_u64 takes a 32-bit divisor; drop precision above 4.29 GHz
+    uint32_t scale = 0;
+    while ((hz >> scale) > 0xFFFFFFFFull) scale++;
+    uint32_t divisor = (uint32_t)(hz >> scale);
+    
+    for (uint32_t shift = 32; shift > scale; shift--) {
+        uint64_t mult = div_u64(((uint64_t)NSEC_PER_SEC << (shift - scale)) + divisor / 2, divisor);
+        if (mult > 0xFFFFFFFFull) continue;
+        cs->mult = (uint32_t)mult;
+        cs->shift = shift;
+        return;
+    }
+}
+
+static inline void tk_barrier(void)
+{
+    asm volatile("" : : : "memory");
+}
+
+static uint64_t cycles_to_ns(clocksource_t* cs, uint64_t cycles, uint64_t frac, uint64_t* rem)
+{
+    uint64_t scaled = cycles * cs->mult + frac;
+    if (rem) *rem = scaled & ((1ull << cs->shift) - 1);
+    return scaled >> cs->shift;
+}
+
+// Monotonic now from the base; the caller keeps tk from changing under it
+static uint64_t timekeeper_now(void)
+{
+    if (!tk.cs) return 0;
+    return tk.base_ns + cycles_to_ns(tk.cs, tk.cs->read() - tk.base_cycles, tk.base_frac, NULL);
+}
+
+uint64_t ktime_get_ns(void)
+{
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = tk_seq;
+        tk_barrier();
+        ns = timekeeper_now();
+        tk_barrier();
+    } while ((seq & 1) || seq != tk_seq);
+    return ns;
+}
+
+uint64_t ktime_get_real_ns(void)
+{
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = tk_seq;
+        tk_barrier();
+        ns = tk.real_offset + timekeeper_now();
+        tk_barrier();
+    } while ((seq & 1) || seq != tk_seq);
+    return ns;
+}
+
+void gettimeofday(timeval_t* tv)
+{
+    uint64_t ns = ktime_get_real_ns();
+    uint32_t seconds = (uint32_t)div_u64(ns, NSEC_PER_SEC);
+    tv->tv_sec = seconds;
+    tv->tv_usec = (uint32_t)(ns - (uint64_t)seconds * NSEC_PER_SEC) / 1000;
+}
+
+// Step wall-clock time; the monotonic clock is not touched
+void timekeeping_set_real(uint64_t real_ns)
+{
+    uint32_t irq = irq_save();
+    tk_seq++;
+    tk_barrier();
+    tk.real_offset = real_ns - timekeeper_now();
+    tk_barrier();
+    tk_seq++;
+    irq_restore(irq);
+}
+
+// Fold the elapsed cycles into the base; interrupts must be disabled
+static void timekeeper_advance(void)
+{
+    uint64_t now = tk.cs->read();
+    uint64_t rem;
+    tk.base_ns += cycles_to_ns(tk.cs, now - tk.base_cycles, tk.base_frac, &rem);
+    tk.base_frac = rem;
+    tk.base_cycles = now;
+}
+
+void timekeeping_tick(void)
+{
+    if (!tk.cs) return;
+    
+    tk_seq++;
+    tk_barrier();
+    timekeeper_advance();
+    tk_barrier();
+    tk_seq++;
+}
+
+// Switch to a better clocksource without a jump in time
+static void timekeeper_select(clocksource_t* cs)
+{
+    uint32_t irq = irq_save();
+    tk_seq++;
+    tk_barrier();
+    if (tk.cs) timekeeper_advance();
+    tk.cs = cs;
+    tk.base_cycles = cs->read();
+    tk.base_frac = 0;
+    tk_barrier();
+    tk_seq++;
+    irq_restore(irq);
+}
+
+static bool clocksource_requested(clocksource_t* cs)
+{
+    char option[CLOCKSOURCE_NAME_LEN + 16];
+    strcpy(option, "clocksource=");
+    strcat(option, cs->name);
+    return kernel_boot_option(option);
+}
+
+// The highest rating wins unless "clocksource=<name>" names another
+void clocksource_register(clocksource_t* cs)
+{
+    cs->next = clocksource_list;
+    clocksource_list = cs;
+    
+    if (clocksource_requested(cs)) {
+        clocksource_forced = true;
+        timekeeper_select(cs);
+    } else if (!tk.cs || (!clocksource_forced && cs->rating > tk.cs->rating)) {
+        timekeeper_select(cs);
+    }
+}
+
+static bool tsc_invariant(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(CPUID_EXT_MAX, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_EXT_POWER) return false;
+    cpuid(CPUID_EXT_POWER, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_EDX_INVARIANT_TSC) != 0;
+}
+
+// Count TSC cycles over a fixed number of PIT cycles
+static uint64_t tsc_calibrate_hz(void)
+{
+    uint32_t pit_cycles = PIT_FREQUENCY / 1000 * TSC_CALIBRATE_MS;
+    
+    uint32_t irq = irq_save();
+    uint64_t pit_start = pit_read_cycles();
+    uint64_t tsc_start = rdtsc();
+    uint64_t pit_now;
+    do {
+        pit_now = pit_read_cycles();
+    } while (pit_now - pit_start < pit_cycles);
+    uint64_t tsc_cycles = rdtsc() - tsc_start;
+    irq_restore(irq);
+    
+    return div_u64(tsc_cycles * PIT_FREQUENCY, (uint32_t)(pit_now - pit_start));
+}
+
+// After pit_init: the PIT is always there, the TSC is used when its rate
+// does not change with power states, or when "clocksource=tsc" insists
+void clocksource_init(void)
+{
+    clocksource_set_hz(&pit_clocksource, PIT_FREQUENCY);
+    clocksource_register(&pit_clocksource);
+    
+    if (!tsc_invariant() && !clocksource_requested(&tsc_clocksource)) return;
+    
+    uint64_t hz = tsc_calibrate_hz();
+    if (hz == 0) return;
+    clocksource_set_hz(&tsc_clocksource, hz);
+    clocksource_register(&tsc_clocksource);
+}
+
+// Average cost of one read, timed by the current clocksource
+uint32_t clocksource_bench_ns(clocksource_t* cs)
+{
+    uint32_t irq = irq_save();
+    uint64_t start = ktime_get_ns();
+    for (uint32_t i = 0; i < CLOCKSOURCE_BENCH_READS; i++) {
+        cs->read();
+    }
+    uint64_t elapsed = ktime_get_ns() - start;
+    irq_restore(irq);
+    return (uint32_t)div_u64(elapsed, CLOCKSOURCE_BENCH_READS);
+}
+
+clocksource_t* clocksource_current(void)
+{
+    return tk.cs;
+}
+
+clocksource_t* clocksource_first(void)
+{
+    return clocksource_list;
+}
@@ -0,0 +1,184 @@
+#include "time.h"
+#include "../sched/sched.h"
+#include "../lib/lib.h"
+#include "../kernel.h"
+#include "../cpu.h"
+#include "../smp.h"
+
+// The tick: an interrupt every millisecond from the best clock-event
+// device, which advances the timekeeper, expires timers and charges the
+// running thread. Milliseconds since boot are read from the clocksource
+// rather than counted, so they stay right when ticks come late or not at
+// all. In tickless mode the idle thread stops the tick and asks for a
+// single interrupt at the next timer deadline.
+//
+// With several CPUs only the boot CPU keeps time and runs the timer wheel;
+// the others just charge their running thread. A per-CPU device such as the
+// local APIC timer ticks on every CPU, and an idle application processor
+// turns its own off entirely, since a reschedule IPI is all that can give
+// it work. Any other device only ever interrupts the boot CPU.
+
+#define TICK_NS NSEC_PER_MSEC
+
+static clockevent_t* event_list = NULL;
+static clockevent_t* tick_device = NULL;
+static volatile uint32_t tick_ms = 0;
+static uint32_t tick_stop_deadline;     // Tick the boot CPU's one-shot fires at
+static tick_stats_t tick_stats;
+
+// Before the clock-event devices register
+void tick_init(void)
+{
+    memset(&tick_stats, 0, sizeof(tick_stats));
+    tick_stats.tickless = !kernel_boot_option("tick=periodic");
+}
+
+static void tick_program_periodic(void)
+{
+    if (tick_device->set_periodic) {
+        tick_device->set_periodic();
+    } else {
+        tick_device->set_oneshot(TICK_NS);
+    }
+}
+
+// Interrupts must be disabled
+static void tick_update_ms(void)
+{
+    if (!clocksource_current()) {
+        tick_ms++;
+        return;
+    }
+    uint32_t now = (uint32_t)div_u64(ktime_get_ns(), NSEC_PER_MSEC);
+    if ((int32_t)(now - tick_ms) > 0) tick_ms = now;
+}
+
+void clockevent_register(clockevent_t* dev)
+{
+    uint32_t irq = irq_save();
+    dev->next = event_list;
+    event_list = dev;
+    if (!tick_device || dev->rating > tick_device->rating) {
+        if (tick_device && tick_device->shutdown) tick_device->shutdown();
+        tick_device = dev;
+        this_cpu()->tick_stopped = false;
+        tick_program_periodic();
+    }
+    irq_restore(irq);
+}
+
+clockevent_t* clockevent_current(void)
+{
+    return tick_device;
+}
+
+clockevent_t* clockevent_first(void)
+{
+    return event_list;
+}
+
+// Timer interrupt of whichever device drives the tick
+void tick_handle(void)
+{
+    cpu_t* cpu = this_cpu();
+    if (cpu->id == 0) {
+        tick_stats.interrupts++;
+        timekeeping_tick();
+        tick_update_ms();
+    }
+    
+    // One-shot devices re-arm themselves to stand in for a periodic tick
+    if (tick_device && !tick_device->set_periodic && !cpu->tick_stopped) {
+        tick_device->set_oneshot(TICK_NS);
+    }
+    
+    if (cpu->id == 0) ktimer_tick(tick_ms);
+    sched_tick();
+}
+
+uint32_t tick_get_ms(void)
+{
+    return tick_ms;
+}
+
+bool tick_nohz(void)
+{
+    return tick_stats.tickless && tick_device;
+}
+
+// Idle: replace the periodic tick with one interrupt at deadline (a tick
+// count), or sooner if the clocksource needs reading before it wraps.
+// Interrupts must be disabled.
+void tick_stop(uint32_t deadline)
+{
+    if (!tick_nohz()) return;
+    
+    cpu_t* cpu = this_cpu();
+    if (cpu->id != 0) {
+        if (!tick_device->per_cpu) return;
+        tick_device->shutdown();
+        cpu->tick_stopped = true;
+        tick_stats.idle_stops++;
+        return;
+    }
+    
+    uint64_t now = ktime_get_ns();
+    uint64_t now_ms = div_u64(now, NSEC_PER_MSEC);
+    tick_update_ms();
+    
+    int32_t ahead = (int32_t)(deadline - (uint32_t)now_ms);
+    uint64_t target = (now_ms + (ahead > 0 ? (uint32_t)ahead : 0)) * NSEC_PER_MSEC;
+    uint64_t delta = target > now ? target - now : 0;
+    
+    uint64_t limit = tick_device->max_delta_ns;
+    clocksource_t* cs = clocksource_current();
+    if (cs && cs->max_idle_ns < limit) limit = cs->max_idle_ns;
+    if (delta > limit) delta = limit;
+    if (delta < tick_device->min_delta_ns) delta = tick_device->min_delta_ns;
+    
+    tick_device->set_oneshot(delta);
+    tick_stop_deadline = (uint32_t)div_u64(now + delta, NSEC_PER_MSEC);
+    cpu->tick_stopped = true;
+    tick_stats.idle_stops++;
+}
+
+// A timer was armed to expire at tick expires. If the boot CPU, which runs
+// the timer wheel, sleeps past that in tickless idle, wake it so it
+// programs the earlier deadline; the boot CPU itself does that anyway on
+// its way back to idle. Must be inside irq_save.
+void tick_timer_armed(uint32_t expires)
+{
+    cpu_t* boot = smp_cpu(0);
+    if (!boot || boot == this_cpu() || !boot->tick_stopped) return;
+    if ((int32_t)(expires - tick_stop_deadline) >= 0) return;
+    
+    // One IPI per earlier deadline; the boot CPU sets its own on waking
+    tick_stop_deadline = expires;
+    smp_send_reschedule(boot);
+}
+
+// Leaving idle: back to the periodic tick for slices and timers
+void tick_restart(void)
+{
+    cpu_t* cpu = this_cpu();
+    if (!cpu->tick_stopped) return;
+    
+    cpu->tick_stopped = false;
+    if (cpu->id == 0) tick_update_ms();
+    tick_program_periodic();
+}
+
+// An application processor starts its own tick, if the device has one per
+// CPU; interrupts must be disabled
+void tick_start_cpu(void)
+{
+    if (!tick_device || !tick_device->per_cpu) return;
+    
+    this_cpu()->tick_stopped = false;
+    tick_program_periodic();
+}
+
+void tick_get_stats(tick_stats_t* stats)
+{
+    *stats = tick_stats;
+}
@@ -0,0 +1,80 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define NSEC_PER_SEC 1000000000u
+#define NSEC_PER_MSEC 1000000u
+#define CLOCKSOURCE_NAME_LEN 8
+
+// A free-running counter; ns = cycles * mult >> shift
+typedef struct clocksource {
+    char name[CLOCKSOURCE_NAME_LEN];
+    uint64_t (*read)(void);
+    uint64_t hz;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t rating;            // Highest usable rating wins
+    uint64_t max_idle_ns;       // Longest gap between reads before the counter wraps
+    struct clocksource* next;
+} clocksource_t;
+
+void clocksource_init(void);
+void clocksource_set_hz(clocksource_t* cs, uint64_t hz);
+void clocksource_register(clocksource_t* cs);
+clocksource_t* clocksource_current(void);
+clocksource_t* clocksource_first(void);
+uint32_t clocksource_bench_ns(clocksource_t* cs);
+
+// A device that can interrupt after a given delay
+typedef struct clockevent {
+    char name[CLOCKSOURCE_NAME_LEN];
+    uint32_t rating;
+    uint64_t min_delta_ns;
+    uint64_t max_delta_ns;
+    void (*set_periodic)(void);             // 1 kHz; NULL to emulate it with one-shots
+    void (*set_oneshot)(uint64_t delta_ns);
+    void (*shutdown)(void);
+    bool per_cpu;                           // Each CPU programs its own, like the local APIC timer
+    struct clockevent* next;
+} clockevent_t;
+
+typedef struct {
+    bool tickless;              // Idle stops the tick; "tick=periodic" on the command line disables it
+    uint32_t interrupts;
+    uint32_t idle_stops;        // Times the periodic tick gave way to a one-shot
+} tick_stats_t;
+
+void tick_init(void);
+void clockevent_register(clockevent_t* dev);
+clockevent_t* clockevent_current(void);
+clockevent_t* clockevent_first(void);
+void tick_handle(void);
+uint32_t tick_get_ms(void);
+bool tick_nohz(void);
+void tick_stop(uint32_t deadline);
+void tick_restart(void);
+void tick_start_cpu(void);
+void tick_timer_armed(uint32_t expires);
+void tick_get_stats(tick_stats_t* stats);
+
+// Monotonic time since clocksource_init; safe from any context
+uint64_t ktime_get_ns(void);
+
+// Called from the tick interrupt to fold elapsed cycles into the base
+void timekeeping_tick(void);
+
+// Wall-clock time, as gettimeofday returns it
+typedef struct {
+    uint32_t tv_sec;            // Seconds since 1970-01-01 in the RTC's time zone
+    uint32_t tv_usec;
+} timeval_t;
+
+// Nanoseconds since 1970; the monotonic clock plus an offset set from the RTC
+uint64_t ktime_get_real_ns(void);
+void gettimeofday(timeval_t* tv);
+void timekeeping_set_real(uint64_t real_ns);
+
+#endif